@@ -4,7 +4,11 @@
 #include <vector>
 #include <cstdio>
 #include <fstream>
+#include <sstream>
+#include <thread>
 #include "symboltable.hpp"
+#include "backend.hpp"
+#include "module.hpp"
 #define YYERROR_VERBOSE 1
 
 extern "C" int yylex();
@@ -13,8 +17,16 @@ extern "C" FILE *yyin;
 extern int lineNum;
 extern char *yytext;
 std::shared_ptr<SymbolTable> SymbolTable::instance;
-std::fstream emit;
+std::stringstream emit;
 bool verbose=false;
+bool streaming=false;
+int threads=0;
+bool boundsCheck=false;
+int unrollBudget=64;
+int evalBudget=10000;
+bool native=false;
+extern LatencyModel latency;
+std::string exportFile;
 void yyerror(const char *str);
 %}
 
@@ -22,6 +34,7 @@ void yyerror(const char *str);
   int intVal;
   char *strVal;
   std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> *typeList;
+  ParamList *paramList;
   std::vector<std::string> *identList;
   std::vector<Expression> *exprList;
   Array *arrVal;
@@ -38,7 +51,8 @@ void yyerror(const char *str);
 %token <none> ARRAY_SYM BEGIN_SYM CHR_SYM CONST_SYM DO_SYM DOWNTO_SYM ELSE_SYM ELSEIF_SYM END_SYM FOR_SYM FORWARD_SYM FUNCTION_SYM IF_SYM OF_SYM ORD_SYM PRED_SYM PROCEDURE_SYM READ_SYM RECORD_SYM REPEAT_SYM RETURN_SYM STOP_SYM SUCC_SYM THEN_SYM TO_SYM TYPE_SYM UNTIL_SYM VAR_SYM WHILE_SYM WRITE_SYM DOT_SYM COMMA_SYM COLON_SYM SEMICOLON_SYM LPAREN_SYM RPAREN_SYM LBRACK_SYM RBRACK_SYM
 
 %type <identList> IdentList MoreIdents 
-%type <typeList> FormalParameters MoreParams RecVars
+%type <typeList> RecVars
+%type <paramList> FormalParameters MoreParams
 %type <constVal> ConstPrim ConstExpression
 %type <typeVal> Type SimpleType
 %type <recVal> RecordType 
@@ -70,90 +84,91 @@ program: Declarations Block DOT_SYM{
       SymbolTable::getInstance()->popScope();
       SymbolTable::getInstance()->emitEnd();
     }
+  | Declarations DOT_SYM{
+      SymbolTable::getInstance()->popScope();
+      SymbolTable::getInstance()->popScope();
+      SymbolTable::getInstance()->emitEnd();
+    }
   ;
 
 Declarations: ConstantDecl TypeDecl VarDecl ProFuncDecl{
+      SymbolTable::getInstance()->placeImports();
+      if(!exportFile.empty()){
+        exportModule(exportFile);
+      }
       emit<<"__main:"<<std::endl<<"move $fp, $sp"<<std::endl<<"move $gp, $fp"<<std::endl;
     }
   ;
 
 ConstantDecl:
   | CONST_SYM MoreConst IDENTIFIER_SYM EQUALS_SYM ConstExpression SEMICOLON_SYM{
+      resolveConst(*$5);
       $5->name=$3;
       SymbolTable::getInstance()->addSymbol($3, *$5, true);
+      free($3);
+      delete $5;
     }
   ;
 MoreConst:
   | MoreConst IDENTIFIER_SYM EQUALS_SYM ConstExpression SEMICOLON_SYM{
+      resolveConst(*$4);
       $4->name=$2;
       SymbolTable::getInstance()->addSymbol($2, *$4, true);
+      free($2);
+      delete $4;
     }
   ;
 TypeDecl:
   | TYPE_SYM MoreType IDENTIFIER_SYM EQUALS_SYM Type SEMICOLON_SYM{
-      $5->name=$3; 
-      switch($5->typeType){
-        case Type::type:SymbolTable::getInstance()->addSymbol($3, *$5, true);
-          break;
-        case Type::array:SymbolTable::getInstance()->addSymbol($3, *(dynamic_cast<Array*>($5)), true);
-          break;
-        case Type::record:SymbolTable::getInstance()->addSymbol($3, *(dynamic_cast<Record*>($5)), true);
-          break;
-      }
+      SymbolTable::getInstance()->addType($3, $5);
+      free($3);
     }
   ;
 MoreType:
   | MoreType IDENTIFIER_SYM EQUALS_SYM Type SEMICOLON_SYM{
-      $4->name=$2; 
-      switch($4->typeType){
-        case Type::type:SymbolTable::getInstance()->addSymbol($2, *$4, true);
-          break;
-        case Type::array:SymbolTable::getInstance()->addSymbol($2, *(dynamic_cast<Array*>($4)), true);
-          break;
-        case Type::record:SymbolTable::getInstance()->addSymbol($2, *(dynamic_cast<Record*>($4)), true);
-          break;
-      }
+      SymbolTable::getInstance()->addType($2, $4);
+      free($2);
     }
   ;
 Type: SimpleType{
       $<typeVal>$=$1;
     }
   | RecordType{
-      if(!SymbolTable::getInstance()->lookup($1->name)){
-          SymbolTable::getInstance()->addSymbol($1->name, *(dynamic_cast<Record*>($1)), true);
-        }
       $<recVal>$=$1;
     }
   | ArrayType{
-      if(!SymbolTable::getInstance()->lookup($1->name)){
-          SymbolTable::getInstance()->addSymbol($1->name, *(dynamic_cast<Array*>($1)), true);
-        }
       $<arrVal>$=$1;
     }
   ;
 SimpleType: IDENTIFIER_SYM{
       SymbolTable::getInstance()->checkType($1);
       $$=dynamic_cast<Type*>(SymbolTable::getInstance()->getSymbol($1).get());
+      free($1);
     }
   ;
 RecordType: RECORD_SYM RecVars END_SYM{
-      $$=new Record(*$2);
+      $$=dynamic_cast<Record*>(SymbolTable::getInstance()->internType(std::make_shared<Record>(*$2)).get());
+      delete $2;
     }
   ;
 RecVars: {
       $$=new std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>>();
     }
   | RecVars IdentList COLON_SYM Type SEMICOLON_SYM{
-      $1->push_back(std::make_pair(*$2, std::make_shared<Type>(*$4)));
+      $1->push_back(std::make_pair(*$2, SymbolTable::getInstance()->getType($4->id)));
+      delete $2;
       $$=$1;
     }
   ;
 ArrayType: ARRAY_SYM LBRACK_SYM ConstExpression COLON_SYM ConstExpression RBRACK_SYM OF_SYM Type{
-      $$=new Array($8, *$3, *$5);
+      $$=dynamic_cast<Array*>(SymbolTable::getInstance()->internType(std::make_shared<Array>($8, *$3, *$5)).get());
+      delete $3;
+      delete $5;
     }
   ;
 IdentList: MoreIdents IDENTIFIER_SYM{
       $1->push_back($2);
+      free($2);
       $$=$1;
     }
   ;
@@ -162,6 +177,7 @@ MoreIdents: {
     }
   | MoreIdents IDENTIFIER_SYM COMMA_SYM{
       $1->push_back($2);
+      free($2);
       $$=$1;
     }
   ;
@@ -169,30 +185,22 @@ VarDecl:
   | VAR_SYM MoreVars IdentList COLON_SYM Type SEMICOLON_SYM{
       std::for_each($3->begin(), $3->end(), 
         [&](std::string val){
-          if(!SymbolTable::getInstance()->lookup($5->name)){
-            switch($5->typeType){
-              case Type::type:SymbolTable::getInstance()->addSymbol($5->name, *$5, true);
-                break;
-              case Type::array:SymbolTable::getInstance()->addSymbol($5->name, *(dynamic_cast<Array*>($5)), true);
-                break;
-              case Type::record:SymbolTable::getInstance()->addSymbol($5->name, *(dynamic_cast<Record*>($5)), true);
-                break;
-            }
-          }
-          Var var(*$5, SymbolTable::getInstance()->offset.back(), val);
+          Var var(SymbolTable::getInstance()->getType($5->id), SymbolTable::getInstance()->offset.back(), val);
           SymbolTable::getInstance()->offset.back()+=$5->size;
           SymbolTable::getInstance()->addSymbol(val, var, true);
         });
+      delete $3;
     }
   ;
 MoreVars:
   | MoreVars IdentList COLON_SYM Type SEMICOLON_SYM{
       std::for_each($2->begin(), $2->end(), 
         [&](std::string val){
-          Var var(*$4, SymbolTable::getInstance()->offset.back(), val);
+          Var var(SymbolTable::getInstance()->getType($4->id), SymbolTable::getInstance()->offset.back(), val);
           SymbolTable::getInstance()->offset.back()+=$4->size;
           SymbolTable::getInstance()->addSymbol(val, var, true);
         });
+      delete $2;
     }
   ;
 ProFuncDecl:
@@ -200,57 +208,78 @@ ProFuncDecl:
   | ProFuncDecl FunctionDecl
   ;
 ProcedureDecl: PROCEDURE_SYM IDENTIFIER_SYM LPAREN_SYM FormalParameters RPAREN_SYM SEMICOLON_SYM FORWARD_SYM SEMICOLON_SYM{
-      Function func(std::string($2), *$4);
+      Function func(std::string($2), $4->typeList);
+      func.refs=$4->refs;
       SymbolTable::getInstance()->addFunction($2, func, true);
+      free($2);
+      delete $4;
     }
   | ProcedureStart Body SEMICOLON_SYM{
+      emit<<"jr $ra"<<std::endl;
       SymbolTable::getInstance()->popScope();
     }
   ;
 ProcedureStart: PROCEDURE_SYM IDENTIFIER_SYM LPAREN_SYM FormalParameters RPAREN_SYM SEMICOLON_SYM{
-      Function func(std::string($2), *$4, true);
+      Function func(std::string($2), $4->typeList, true);
+      func.refs=$4->refs;
       SymbolTable::getInstance()->addFunction($2, func);
       SymbolTable::getInstance()->pushScope(func);
       emit<<func.location<<":"<<std::endl;
+      free($2);
+      delete $4;
     }
   ;
 FunctionDecl: FUNCTION_SYM IDENTIFIER_SYM LPAREN_SYM FormalParameters RPAREN_SYM COLON_SYM Type SEMICOLON_SYM FORWARD_SYM SEMICOLON_SYM{
-      Function func(std::string($2), *$7, *$4);
+      Function func(std::string($2), SymbolTable::getInstance()->getType($7->id), $4->typeList);
+      func.refs=$4->refs;
       SymbolTable::getInstance()->addFunction($2, func, true);
+      free($2);
+      delete $4;
     }
   | FunctionStart Body SEMICOLON_SYM{
-      SymbolTable::getInstance()->popScope();
       emit<<"jr $ra"<<std::endl;
+      SymbolTable::getInstance()->popScope();
     }
   ;
 FunctionStart: FUNCTION_SYM IDENTIFIER_SYM LPAREN_SYM FormalParameters RPAREN_SYM COLON_SYM Type SEMICOLON_SYM{
-      Function func(std::string($2), *$7, *$4, true);
+      Function func(std::string($2), SymbolTable::getInstance()->getType($7->id), $4->typeList, true);
+      func.refs=$4->refs;
       SymbolTable::getInstance()->addFunction($2, func);
       SymbolTable::getInstance()->pushScope(func);
       emit<<func.location<<":"<<std::endl;
+      free($2);
+      delete $4;
     }
   ;
 FormalParameters: {
-      $$=new std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>>();
+      $$=new ParamList();
     }
   | MoreParams IdentList COLON_SYM Type{
-      $1->push_back(std::make_pair(*$2, std::make_shared<Type>(*$4)));
+      $1->typeList.push_back(std::make_pair(*$2, SymbolTable::getInstance()->getType($4->id)));
+      $1->refs.push_back(false);
+      delete $2;
       $$=$1;
     }
   | MoreParams VAR_SYM IdentList COLON_SYM Type{
-      $1->push_back(std::make_pair(*$3, std::make_shared<Type>(*$5)));
+      $1->typeList.push_back(std::make_pair(*$3, SymbolTable::getInstance()->getType($5->id)));
+      $1->refs.push_back(true);
+      delete $3;
       $$=$1;
     }
   ;
 MoreParams: {
-      $$=new std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>>();
+      $$=new ParamList();
     }
   | MoreParams IdentList COLON_SYM Type SEMICOLON_SYM{
-      $1->push_back(std::make_pair(*$2, std::make_shared<Type>(*$4)));
+      $1->typeList.push_back(std::make_pair(*$2, SymbolTable::getInstance()->getType($4->id)));
+      $1->refs.push_back(false);
+      delete $2;
       $$=$1;
     }
   | MoreParams VAR_SYM IdentList COLON_SYM Type SEMICOLON_SYM{
-      $1->push_back(std::make_pair(*$3, std::make_shared<Type>(*$5)));
+      $1->typeList.push_back(std::make_pair(*$3, SymbolTable::getInstance()->getType($5->id)));
+      $1->refs.push_back(true);
+      delete $3;
       $$=$1;
     }
   ;
@@ -308,6 +337,8 @@ LValue: IDENTIFIER_SYM Sublval{
       $2->push_back(*temp);
       std::reverse($2->begin(), $2->end());
       $$=getLval(*$2);
+      free($1);
+      delete $2;
     }
   ;
 Sublval:{
@@ -316,9 +347,11 @@ Sublval:{
   | DOT_SYM IDENTIFIER_SYM Sublval{
       auto temp=new Expression(std::string($2), Expression::stringType);
       $3->push_back(*temp);
+      free($2);
       $$=$3;
     }
   | LBRACK_SYM Expression RBRACK_SYM Sublval{
+      SymbolTable::getInstance()->keepTemp($2);
       $4->push_back(*$2);
       $$=$4;
     }
@@ -326,11 +359,15 @@ Sublval:{
 Expression: SimpleExprPrim{
       $$=$1;
     }
-  | Expression OR_SYM Expression{
-      $$=eval($1, $3, "or");
+  | Expression OR_SYM{
+      shortCircuitLeft($1, "or");
+    } Expression{
+      $$=shortCircuitRight($1, $4, "or");
     }
-  | Expression AND_SYM Expression{
-      $$=eval($1, $3, "and");
+  | Expression AND_SYM{
+      shortCircuitLeft($1, "and");
+    } Expression{
+      $$=shortCircuitRight($1, $4, "and");
     }
   | Expression EQUALS_SYM Expression{
       $$=eval($1, $3, "seq");
@@ -377,10 +414,18 @@ Expression: SimpleExprPrim{
   | ProcedureCall{
       $$=$1;
     }
-  | CHR_SYM LPAREN_SYM Expression RPAREN_SYM
-  | ORD_SYM LPAREN_SYM Expression RPAREN_SYM
-  | PRED_SYM LPAREN_SYM Expression RPAREN_SYM
-  | SUCC_SYM LPAREN_SYM Expression RPAREN_SYM
+  | CHR_SYM LPAREN_SYM Expression RPAREN_SYM{
+      $$=intrinsic($3, "chr");
+    }
+  | ORD_SYM LPAREN_SYM Expression RPAREN_SYM{
+      $$=intrinsic($3, "ord");
+    }
+  | PRED_SYM LPAREN_SYM Expression RPAREN_SYM{
+      $$=intrinsic($3, "pred");
+    }
+  | SUCC_SYM LPAREN_SYM Expression RPAREN_SYM{
+      $$=intrinsic($3, "succ");
+    }
   ;
 SimpleExprPrim: LValue{
       $$=$1;
@@ -390,6 +435,7 @@ SimpleExprPrim: LValue{
     }
   | CHAR_SYM{
       $$=new Expression($1[1], Expression::charType, true);
+      free($1);
     }
   | STRING_SYM{
       if(SymbolTable::getInstance()->lookup(std::string($1))){
@@ -400,7 +446,9 @@ SimpleExprPrim: LValue{
         auto temp=new Const(std::string($1), std::string($1));
         SymbolTable::getInstance()->addSymbol(std::string($1), *temp, true);
         $$=new Expression(temp->location, Expression::stringType, true);
+        delete temp;
       }
+      free($1);
     }
   ;
 ConstExpression: ConstPrim{
@@ -408,70 +456,118 @@ ConstExpression: ConstPrim{
     }
   | ConstExpression OR_SYM ConstExpression{
       $$=orOp(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression AND_SYM ConstExpression{
       $$=andOp(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression EQUALS_SYM ConstExpression{
       $$=eq(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression NEQ_SYM ConstExpression{
       $$=neq(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression LTE_SYM ConstExpression{
       $$=lte(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression GTE_SYM ConstExpression{
       $$=gte(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression LT_SYM ConstExpression{
       $$=lt(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression GT_SYM ConstExpression{
       $$=gt(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression ADD_SYM ConstExpression{
       $$=add(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression SUB_SYM ConstExpression{
       $$=sub(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression MULT_SYM ConstExpression{
       $$=mult(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression DIV_SYM ConstExpression{
       $$=div(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | ConstExpression MOD_SYM ConstExpression{
       $$=mod(*$1, *$3);
+      delete $1;
+      delete $3;
     }
   | NOT_SYM ConstExpression{
       $$=notOp(*$2);
+      delete $2;
     }
   | SUB_SYM ConstExpression %prec UNARYMINUS_SYM{
       $$=negative(*$2);
+      delete $2;
     }
   | LPAREN_SYM ConstExpression RPAREN_SYM{
       $$=$2;
     }
+  | CHR_SYM LPAREN_SYM ConstExpression RPAREN_SYM{
+      $$=chrOp(*$3);
+      delete $3;
+    }
+  | ORD_SYM LPAREN_SYM ConstExpression RPAREN_SYM{
+      $$=ordOp(*$3);
+      delete $3;
+    }
+  | PRED_SYM LPAREN_SYM ConstExpression RPAREN_SYM{
+      $$=step(*$3, -1);
+      delete $3;
+    }
+  | SUCC_SYM LPAREN_SYM ConstExpression RPAREN_SYM{
+      $$=step(*$3, 1);
+      delete $3;
+    }
   ;  
 ConstPrim: NUM_SYM{
       $$=new Const($1);
     }
   | CHAR_SYM{
       $$=new Const($1[1]);
+      free($1);
     }
   | STRING_SYM{
       $$=new Const(std::string($1), std::string($1));
+      free($1);
     }
   | IDENTIFIER_SYM{
       $$=new Const(std::string($1), Const::identType);
+      free($1);
     }
   ;
 Arguments: {
       $$=new std::vector<Expression>();
     }
   | MoreArgs Expression{
+      SymbolTable::getInstance()->keepTemp($2);
       $1->push_back(*$2);
       $$=$1;
     }
@@ -480,6 +576,7 @@ MoreArgs: {
       $$=new std::vector<Expression>();
     }
   | MoreArgs Expression COMMA_SYM{
+      SymbolTable::getInstance()->keepTemp($2);
       $1->push_back(*$2);
       $$=$1;
     }
@@ -547,22 +644,28 @@ ForStatement: ForToStatement
   | ForDowntoStatement
   ;
 ForToStatement: ForMidTo DO_SYM StatementSequence END_SYM{
+      forRangeEnd();
       assign($1, eval($1, new Expression(1, Expression::intType, true), "add"));
       controlEnd();
+      forUnroll();
     }
   ;
 ForDowntoStatement: ForMidDownto DO_SYM StatementSequence END_SYM{
+      forRangeEnd();
       assign($1, eval($1, new Expression(1, Expression::intType, true), "sub"));
       controlEnd();
+      forUnroll();
     }
   ;
 ForMidTo: ForBegin TO_SYM Expression{
       controlCheck(eval($1, $3, "sgt"));
+      forRangeLimit($3, false);
       $$=$1;
     }
   ;
 ForMidDownto: ForBegin DOWNTO_SYM Expression{
       controlCheck(eval($1, $3, "slt"));
+      forRangeLimit($3, true);
       $$=$1;
     }
   ;
@@ -572,22 +675,34 @@ ForBegin: FOR_SYM IDENTIFIER_SYM ASSIGN_SYM Expression{
       tempVec->push_back(*temp);
       auto expr=getLval(*tempVec);
       assign(expr, $4);
+      forRangeBegin(expr, $4);
+      free($2);
+      delete tempVec;
       controlBegin();
       $$=expr;
     }
   ;
 StopStatement: STOP_SYM{
+      noteIO();
       emit<<"li $v0, 10"<<std::endl<<"syscall"<<std::endl;
     }
   ;
 ReturnStatement: RETURN_SYM Expression{
       doReturn($2);
     }
-  | RETURN_SYM
+  | RETURN_SYM{
+      if(SymbolTable::getInstance()->funcStack.back()){
+        emit<<"jr $ra"<<std::endl;
+      }
+      else{
+        emit<<"li $v0, 10"<<std::endl<<"syscall"<<std::endl;
+      }
+    }
   ;
 ReadStatement: READ_SYM LPAREN_SYM MoreLVals LValue RPAREN_SYM{
       $3->push_back(*$4);
       read(*$3);
+      delete $3;
     }
   ;
 MoreLVals: {
@@ -599,20 +714,25 @@ MoreLVals: {
     }
   ;
 WriteStatement: WRITE_SYM LPAREN_SYM ExprList Expression RPAREN_SYM{
+      SymbolTable::getInstance()->keepTemp($4);
       $3->push_back(*$4);
       write(*$3);
+      delete $3;
     }
   ;
 ExprList: {
       $$=new std::vector<Expression>();
     }
   | ExprList Expression COMMA_SYM{
+      SymbolTable::getInstance()->keepTemp($2);
       $1->push_back(*$2);
       $$=$1;
     }
   ;
 ProcedureCall: IDENTIFIER_SYM LPAREN_SYM Arguments RPAREN_SYM{
       $$=doFunc($1, *$3);
+      free($1);
+      delete $3;
     }
   ;
 NullStatement:
@@ -630,19 +750,61 @@ int main(int argc, char **argv){
     std::cout<<"Error opening file\n";
     return -1;
   }
-  if(argc>=3){
-    if(std::string(argv[2])=="-v"){
+  std::vector<std::string> imports;
+  for(int i=2;i<argc;++i){
+    if(std::string(argv[i])=="-i"&&i+1<argc){
+      imports.push_back(argv[++i]);
+      continue;
+    }
+    if(std::string(argv[i])=="-e"&&i+1<argc){
+      exportFile=argv[++i];
+      continue;
+    }
+    if(std::string(argv[i])=="-v"){
       verbose=true;
     }
+    if(std::string(argv[i])=="-s"){
+      streaming=true;
+    }
+    if(std::string(argv[i])=="--bounds-check"){
+      boundsCheck=true;
+    }
+    if(std::string(argv[i]).substr(0, 9)=="--unroll="){
+      unrollBudget=std::stoi(std::string(argv[i]).substr(9));
+    }
+    if(std::string(argv[i]).substr(0, 13)=="--eval-steps="){
+      evalBudget=std::stoi(std::string(argv[i]).substr(13));
+    }
+    if(std::string(argv[i])=="--x86"){
+      native=true;
+    }
+    if(std::string(argv[i]).substr(0, 2)=="-l"){
+      std::stringstream lat(std::string(argv[i]).substr(2));
+      char sep;
+      lat>>latency.load>>sep>>latency.mult>>sep>>latency.div;
+    }
+    if(std::string(argv[i]).substr(0, 2)=="-j"){
+      threads=((std::string(argv[i]).size()>2)?(std::stoi(std::string(argv[i]).substr(2))):(std::thread::hardware_concurrency()));
+      threads=std::max(threads, 1);
+    }
+  }
+  for(int i=0;i<imports.size();++i){
+    if(!importModule(imports[i])){
+      std::cout<<"Error importing "<<imports[i]<<"\n";
+      return -1;
+    }
   }
   std::string emitFile(argv[1]);
-  emitFile+=".cpsl";
-  emit.open(emitFile.data(), std::ios::out);
+  emitFile+=((native)?(".s"):(".cpsl"));
+  openOutput(emitFile);
   emit<<".text"<<std::endl<<".globl __main"<<std::endl<<"j __main"<<std::endl;
   yyin=temp;
   yyparse();
-  emit.close();
+  closeOutput();
   std::cout<<"Compiled to "<<emitFile<<std::endl;
+  if(boundsCheck){
+    std::cout<<"Bounds checks: "<<SymbolTable::getInstance()->boundsRemoved<<" of "<<SymbolTable::getInstance()->boundsChecks<<" removed"<<std::endl;
+  }
 }
 
 void yyerror(const char *str){
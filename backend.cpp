@@ -0,0 +1,1091 @@
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <map>
+#include <set>
+#include <climits>
+#include "backend.hpp"
+#include "x86.hpp"
+extern bool verbose;
+extern bool streaming;
+extern int threads;
+extern bool native;
+extern int evalBudget;
+extern std::stringstream emit;
+LatencyModel latency;
+std::ofstream output;
+std::vector<CodeUnit> units;
+std::vector<Line> pureLines;
+//Where pure code's labels and jump table words sit, kept up to date as code is added so evaluate doesn't rescan it
+const int pureCodeBase=0x00400000, pureDataBase=0x10000000;
+std::map<std::string, int> pureLabels;
+std::map<int, int> pureData;
+std::vector<std::pair<int, std::string>> pureWords;
+int pureDataEnd=pureDataBase;
+
+Line::Line(std::string raw, bool data):raw(raw)
+,data(data){
+  int pos=0;
+  while(true){
+    int start=pos;
+    while(start<raw.size()&&isspace(raw[start])){
+      ++start;
+    }
+    int end=start;
+    while(end<raw.size()&&(isalnum(raw[end])||raw[end]=='_'||raw[end]=='$'||(raw[end]=='.'&&end>start))){
+      ++end;
+    }
+    if(end==start||end>=raw.size()||raw[end]!=':'){
+      pos=start;
+      break;
+    }
+    labels.push_back(raw.substr(start, end-start));
+    pos=end+1;
+  }
+  auto rest=raw.substr(pos);
+  rest.erase(rest.find_last_not_of(" \t")+1);
+  if(rest.empty()){
+    //Blanked code leaves lines of spaces behind
+    if(labels.empty()){
+      this->raw="";
+    }
+    return;
+  }
+  auto split=rest.find_first_of(" \t");
+  op=rest.substr(0, split);
+  if(split==std::string::npos){
+    return;
+  }
+  rest=rest.substr(rest.find_first_not_of(" \t", split));
+  if(op[0]=='.'){
+    args.push_back(rest);
+    return;
+  }
+  std::stringstream argStream(rest);
+  std::string arg;
+  while(std::getline(argStream, arg, ',')){
+    arg.erase(0, arg.find_first_not_of(" \t"));
+    arg.erase(arg.find_last_not_of(" \t")+1);
+    args.push_back(arg);
+  }
+};
+
+bool Line::isInstr(){
+  return !data&&!op.empty()&&op[0]!='.';
+};
+
+bool Line::isTerminator(){
+  return isInstr()&&(op[0]=='j'||op[0]=='b'||op=="syscall");
+};
+
+//Registers written and read, and whether the instruction loads (1) or stores (2) through base+offset.
+//Returns false for anything the scheduler doesn't know, which then stays where it is.
+bool Line::operands(std::vector<std::string> &defs, std::vector<std::string> &uses, int &mem, std::string &base, int &offset){
+  static const std::vector<std::string> alu={"add", "addi", "addu", "addiu", "sub", "subu", "and", "andi", "or", "ori",
+    "xor", "xori", "nor", "not", "neg", "seq", "sne", "slt", "slti", "sltu", "sltiu", "sgt", "sge", "sle", "sll", "srl",
+    "sra", "move", "li", "la", "mfhi", "mflo", "lw", "sw", "mult", "div"};
+  if(!isInstr()||std::find(alu.begin(), alu.end(), op)==alu.end()){
+    return false;
+  }
+  mem=0;
+  std::vector<std::string> regs;
+  std::for_each(args.begin(), args.end(),
+    [&](std::string arg){
+      auto paren=arg.find('(');
+      if(paren!=std::string::npos){
+        base=arg.substr(paren+1, arg.find(')')-paren-1);
+        offset=std::stoi(arg.substr(0, paren));
+        mem=((op=="lw")?(1):(2));
+        regs.push_back(base);
+      }
+      else if(arg[0]=='$'){
+        regs.push_back(arg);
+      }
+    });
+  if(op=="mult"||op=="div"){
+    defs.push_back("hilo");
+    uses=regs;
+  }
+  else if(op=="mfhi"||op=="mflo"){
+    defs=regs;
+    uses.push_back("hilo");
+  }
+  else if(op=="sw"){
+    uses=regs;
+  }
+  else if(!regs.empty()){
+    defs.push_back(regs[0]);
+    uses.assign(regs.begin()+1, regs.end());
+  }
+  uses.erase(std::remove(uses.begin(), uses.end(), "$zero"), uses.end());
+  return true;
+};
+
+int Line::latency(){
+  if(op=="lw"){
+    return ::latency.load;
+  }
+  if(op=="mult"){
+    return ::latency.mult;
+  }
+  if(op=="div"){
+    return ::latency.div;
+  }
+  return 1;
+};
+
+//Keeps any labels on the line so branches to them still resolve
+void Line::dropInstr(){
+  op="";
+  args.clear();
+  setRaw();
+};
+
+void Line::setRaw(){
+  raw="";
+  std::for_each(labels.begin(), labels.end(),
+    [&](std::string label){
+      raw+=label+": ";
+    });
+  if(op.empty()){
+    return;
+  }
+  raw+=op;
+  for(int i=0;i<args.size();++i){
+    raw+=((i==0)?(" "):(", "))+args[i];
+  }
+};
+
+CodeUnit::CodeUnit(std::string name, std::string code):name(name)
+,labelCount(0)
+,cyclesBefore(0)
+,cyclesAfter(0){
+  std::stringstream codeStream(code);
+  std::string text;
+  bool data=false;
+  while(std::getline(codeStream, text)){
+    Line line(text, data);
+    if(line.op==".data"){
+      data=true;
+    }
+    if(line.op==".text"){
+      data=false;
+      line.data=false;
+    }
+    lines.push_back(line);
+  }
+};
+
+//Labels made by the backend are local to their unit, so they don't depend on which thread ran first
+std::string CodeUnit::newLabel(){
+  return "__"+name+"_L"+std::to_string(labelCount++);
+};
+
+std::string CodeUnit::str(){
+  std::string code;
+  std::for_each(lines.begin(), lines.end(),
+    [&](Line &line){
+      if(!line.raw.empty()){
+        code+=line.raw+"\n";
+      }
+    });
+  return code;
+};
+
+void optimize(CodeUnit &unit){
+  bool changed=true;
+  while(changed){
+    changed=removeUnreachable(unit);
+    changed=removeJumpsToNext(unit)||changed;
+    changed=removeSelfMoves(unit)||changed;
+  }
+  schedule(unit);
+};
+
+bool removeUnreachable(CodeUnit &unit){
+  bool reachable=true, changed=false;
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      if(line.data){
+        return;
+      }
+      if(!line.labels.empty()){
+        reachable=true;
+      }
+      if(!line.isInstr()){
+        return;
+      }
+      if(!reachable){
+        line.dropInstr();
+        changed=true;
+        return;
+      }
+      if(line.op=="j"||line.op=="jr"){
+        reachable=false;
+      }
+    });
+  return changed;
+};
+
+bool removeJumpsToNext(CodeUnit &unit){
+  bool changed=false;
+  for(int i=0;i<unit.lines.size();++i){
+    if(!unit.lines[i].isInstr()||unit.lines[i].op!="j"){
+      continue;
+    }
+    auto target=unit.lines[i].args[0];
+    for(int j=i+1;j<unit.lines.size();++j){
+      if(unit.lines[j].data){
+        continue;
+      }
+      if(std::find(unit.lines[j].labels.begin(), unit.lines[j].labels.end(), target)!=unit.lines[j].labels.end()){
+        unit.lines[i].dropInstr();
+        changed=true;
+        break;
+      }
+      if(unit.lines[j].isInstr()){
+        break;
+      }
+    }
+  }
+  return changed;
+};
+
+bool removeSelfMoves(CodeUnit &unit){
+  bool changed=false;
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      if(line.isInstr()&&line.op=="move"&&line.args[0]==line.args[1]){
+        line.dropInstr();
+        changed=true;
+      }
+    });
+  return changed;
+};
+
+//Splits the unit into straight line blocks that end at a label, a branch or anything the scheduler doesn't know.
+//Long blocks are cut up to keep the dependence graph small.
+void schedule(CodeUnit &unit){
+  std::vector<int> block;
+  auto flush=[&](){
+    if(!block.empty()){
+      scheduleBlock(unit, block, unit.cyclesBefore, unit.cyclesAfter);
+    }
+    block.clear();
+  };
+  for(int i=0;i<unit.lines.size();++i){
+    auto &line=unit.lines[i];
+    if(line.raw.empty()){
+      continue;
+    }
+    if(!line.labels.empty()||block.size()>=256){
+      flush();
+    }
+    std::vector<std::string> defs, uses;
+    int mem, offset;
+    std::string base;
+    if(line.isTerminator()){
+      block.push_back(i);
+      flush();
+    }
+    else if(line.operands(defs, uses, mem, base, offset)){
+      block.push_back(i);
+    }
+    else{
+      flush();
+    }
+  }
+  flush();
+};
+
+//List scheduling: an instruction is ready once everything it depends on has issued, and can issue once the
+//results it reads are available. Among those the one with the longest latency path to the end of the block
+//goes first, so loads and multiplies start early and independent work fills their delay.
+//A branch at the end of the block depends on everything before it and so stays last.
+void scheduleBlock(CodeUnit &unit, std::vector<int> &block, int &before, int &after){
+  int size=block.size();
+  std::vector<std::vector<std::pair<int, int>>> succs(size);
+  std::vector<int> preds(size, 0), height(size, 0);
+  std::vector<std::vector<std::string>> defs(size), uses(size);
+  std::vector<int> mem(size, 0), offset(size, 0), baseDef(size, -1);
+  std::vector<std::string> base(size);
+  std::map<std::string, int> lastDef;
+  std::map<std::string, std::vector<int>> readers;
+  std::vector<int> memOps;
+  auto addEdge=[&](int from, int to, int lat){
+    succs[from].push_back(std::make_pair(to, lat));
+    ++preds[to];
+  };
+  for(int i=0;i<size;++i){
+    auto &line=unit.lines[block[i]];
+    if(!line.operands(defs[i], uses[i], mem[i], base[i], offset[i])){
+      std::for_each(line.args.begin(), line.args.end(),
+        [&](std::string arg){
+          if(arg[0]=='$'){
+            uses[i].push_back(arg);
+          }
+        });
+      mem[i]=2;
+    }
+    if(line.isTerminator()){
+      for(int j=0;j<i;++j){
+        addEdge(j, i, 1);
+      }
+    }
+    std::for_each(uses[i].begin(), uses[i].end(),
+      [&](std::string reg){
+        if(lastDef.count(reg)){
+          addEdge(lastDef[reg], i, unit.lines[block[lastDef[reg]]].latency());
+        }
+      });
+    std::for_each(defs[i].begin(), defs[i].end(),
+      [&](std::string reg){
+        if(lastDef.count(reg)){
+          addEdge(lastDef[reg], i, 1);
+        }
+        std::for_each(readers[reg].begin(), readers[reg].end(),
+          [&](int reader){
+            addEdge(reader, i, 1);
+          });
+      });
+    if(mem[i]){
+      baseDef[i]=((lastDef.count(base[i]))?(lastDef[base[i]]):(-1));
+      //Words at different offsets from the same unchanged base can't overlap
+      std::for_each(memOps.begin(), memOps.end(),
+        [&](int j){
+          bool disjoint=base[i]==base[j]&&offset[i]!=offset[j]&&baseDef[i]==baseDef[j];
+          if((mem[i]==2||mem[j]==2)&&!disjoint){
+            addEdge(j, i, 1);
+          }
+        });
+      memOps.push_back(i);
+    }
+    std::for_each(uses[i].begin(), uses[i].end(),
+      [&](std::string reg){
+        readers[reg].push_back(i);
+      });
+    std::for_each(defs[i].begin(), defs[i].end(),
+      [&](std::string reg){
+        lastDef[reg]=i;
+        readers[reg].clear();
+      });
+  }
+  for(int i=size-1;i>=0;--i){
+    std::for_each(succs[i].begin(), succs[i].end(),
+      [&](std::pair<int, int> succ){
+        height[i]=std::max(height[i], succ.second+height[succ.first]);
+      });
+  }
+  std::vector<int> order, ready(size, 0), waiting(preds);
+  int cycle=0;
+  for(int i=0;i<size;++i){
+    cycle=std::max(cycle, ready[i])+1;
+    std::for_each(succs[i].begin(), succs[i].end(),
+      [&](std::pair<int, int> succ){
+        ready[succ.first]=std::max(ready[succ.first], cycle-1+succ.second);
+      });
+  }
+  before+=cycle;
+  std::fill(ready.begin(), ready.end(), 0);
+  std::vector<int> candidates;
+  for(int i=0;i<size;++i){
+    if(waiting[i]==0){
+      candidates.push_back(i);
+    }
+  }
+  cycle=0;
+  while(order.size()<size){
+    int next=-1, soonest=-1;
+    for(int i=0;i<candidates.size();++i){
+      int temp=candidates[i];
+      if(ready[temp]<=cycle&&(next<0||height[temp]>height[candidates[next]]||(height[temp]==height[candidates[next]]&&temp<candidates[next]))){
+        next=i;
+      }
+      soonest=((soonest<0)?(ready[temp]):(std::min(soonest, ready[temp])));
+    }
+    if(next<0){
+      cycle=soonest;
+      continue;
+    }
+    int temp=candidates[next];
+    candidates.erase(candidates.begin()+next);
+    order.push_back(temp);
+    std::for_each(succs[temp].begin(), succs[temp].end(),
+      [&](std::pair<int, int> succ){
+        ready[succ.first]=std::max(ready[succ.first], cycle+succ.second);
+        if(--waiting[succ.first]==0){
+          candidates.push_back(succ.first);
+        }
+      });
+    ++cycle;
+  }
+  after+=cycle;
+  bool moved=false;
+  for(int i=0;i<size;++i){
+    moved=moved||order[i]!=i;
+  }
+  if(!moved){
+    return;
+  }
+  std::vector<Line> lines;
+  std::for_each(order.begin(), order.end(),
+    [&](int i){
+      lines.push_back(unit.lines[block[i]]);
+      lines.back().labels.clear();
+    });
+  lines[0].labels=unit.lines[block[0]].labels;
+  for(int i=0;i<size;++i){
+    lines[i].setRaw();
+    unit.lines[block[i]]=lines[i];
+  }
+};
+
+//Each worker drains its own queue from the back and steals from the front of the others once it's empty.
+//Units don't spawn more work, so a worker can stop as soon as every queue is empty.
+void runParallel(std::vector<CodeUnit> &units, int threads){
+  std::vector<std::deque<int>> queues(threads);
+  std::vector<std::mutex> locks(threads);
+  for(int i=0;i<units.size();++i){
+    queues[i*threads/units.size()].push_back(i);
+  }
+  std::vector<std::thread> workers;
+  for(int i=0;i<threads;++i){
+    workers.push_back(std::thread([&, i](){
+      while(true){
+        int next=-1;
+        for(int j=0;j<threads&&next<0;++j){
+          int victim=(i+j)%threads;
+          std::lock_guard<std::mutex> guard(locks[victim]);
+          if(queues[victim].empty()){
+            continue;
+          }
+          if(victim==i){
+            next=queues[victim].back();
+            queues[victim].pop_back();
+          }
+          else{
+            next=queues[victim].front();
+            queues[victim].pop_front();
+          }
+        }
+        if(next<0){
+          return;
+        }
+        lower(units[next]);
+      }
+    }));
+  }
+  std::for_each(workers.begin(), workers.end(),
+    [&](std::thread &worker){
+      worker.join();
+    });
+};
+
+bool isImmediate(std::string arg){
+  return !arg.empty()&&(isdigit(arg[0])||(arg[0]=='-'&&arg.size()>1&&isdigit(arg[1])));
+};
+
+//What an instruction computing one register gives for the values of its operands. Move, neg and not
+//only look at the left one.
+bool aluValue(std::string op, int left, int right, int &result){
+  unsigned a=left, b=right;
+  if(op=="add"||op=="addu"||op=="addi"||op=="addiu"){
+    result=a+b;
+  }
+  else if(op=="sub"||op=="subu"){
+    result=a-b;
+  }
+  else if(op=="and"||op=="andi"){
+    result=a&b;
+  }
+  else if(op=="or"||op=="ori"){
+    result=a|b;
+  }
+  else if(op=="xor"||op=="xori"){
+    result=a^b;
+  }
+  else if(op=="nor"){
+    result=~(a|b);
+  }
+  else if(op=="slt"||op=="slti"){
+    result=left<right;
+  }
+  else if(op=="sltu"||op=="sltiu"){
+    result=a<b;
+  }
+  else if(op=="seq"){
+    result=left==right;
+  }
+  else if(op=="sne"){
+    result=left!=right;
+  }
+  else if(op=="sgt"){
+    result=left>right;
+  }
+  else if(op=="sge"){
+    result=left>=right;
+  }
+  else if(op=="sle"){
+    result=left<=right;
+  }
+  else if(op=="sll"){
+    result=a<<(b&31);
+  }
+  else if(op=="srl"){
+    result=a>>(b&31);
+  }
+  else if(op=="sra"){
+    result=left>>(b&31);
+  }
+  else if(op=="move"){
+    result=left;
+  }
+  else if(op=="neg"){
+    result=-a;
+  }
+  else if(op=="not"){
+    result=~a;
+  }
+  else{
+    return false;
+  }
+  return true;
+};
+
+//Propagates constants loaded with li through each straight line block, turning what they decide into
+//li and j and using them as immediates where an add can take one
+bool foldConstants(CodeUnit &unit){
+  bool changed=false;
+  std::map<std::string, int> known;
+  auto value=[&](std::string arg, int &val){
+    if(arg=="$zero"){
+      val=0;
+      return true;
+    }
+    auto it=known.find(arg);
+    if(it==known.end()){
+      return false;
+    }
+    val=it->second;
+    return true;
+  };
+  auto small=[](int val){
+    return val>=-32768&&val<=32767;
+  };
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      if(!line.labels.empty()){
+        known.clear();
+      }
+      if(!line.isInstr()){
+        return;
+      }
+      auto &op=line.op;
+      auto &args=line.args;
+      int left, right, result;
+      if(op=="beq"||op=="bne"){
+        if(value(args[0], left)&&value(args[1], right)){
+          if((left==right)==(op=="beq")){
+            op="j";
+            args={args[2]};
+            line.setRaw();
+          }
+          else{
+            line.dropInstr();
+          }
+          changed=true;
+        }
+        return;
+      }
+      if(op=="li"&&isImmediate(args[1])){
+        known[args[0]]=std::stoi(args[1]);
+        return;
+      }
+      if(op=="mult"||op=="div"){
+        known.erase("hi");
+        known.erase("lo");
+        if(value(args[0], left)&&value(args[1], right)&&(op=="mult"||(right!=0&&(left!=INT_MIN||right!=-1)))){
+          long long product=(long long)left*right;
+          known["lo"]=((op=="mult")?((int)product):(left/right));
+          known["hi"]=((op=="mult")?((int)(product>>32)):(left%right));
+        }
+        return;
+      }
+      bool folded=false;
+      if(op=="mfhi"||op=="mflo"){
+        folded=value(op.substr(2), result);
+      }
+      else if(args.size()==3&&args[1][0]=='$'&&value(args[1], left)&&(isImmediate(args[2])||value(args[2], right))){
+        folded=aluValue(op, left, ((isImmediate(args[2]))?(std::stoi(args[2])):(right)), result);
+      }
+      else if(args.size()==2&&args[1][0]=='$'&&(op=="move"||op=="neg"||op=="not")&&value(args[1], left)){
+        folded=aluValue(op, left, 0, result);
+      }
+      if(folded){
+        op="li";
+        args={args[0], std::to_string(result)};
+        line.setRaw();
+        known[args[0]]=result;
+        changed=true;
+        return;
+      }
+      if((op=="add"||op=="addu"||op=="sub"||op=="subu")&&args.size()==3&&args[2][0]=='$'){
+        bool sub=(op[0]=='s');
+        if(value(args[2], right)&&small((sub)?(-(long long)right):(right))){
+          op=((op.size()==4)?("addiu"):("addi"));
+          args[2]=std::to_string((sub)?(-right):(right));
+          line.setRaw();
+          changed=true;
+        }
+        else if(!sub&&value(args[1], left)&&small(left)){
+          op=((op.size()==4)?("addiu"):("addi"));
+          args[1]=args[2];
+          args[2]=std::to_string(left);
+          line.setRaw();
+          changed=true;
+        }
+      }
+      std::vector<std::string> defs, uses;
+      int mem, offset;
+      std::string base;
+      //A syscall only ever writes its result to $v0
+      if(op=="syscall"){
+        known.erase("$v0");
+        return;
+      }
+      if(op=="jal"||!line.operands(defs, uses, mem, base, offset)){
+        known.clear();
+        return;
+      }
+      std::for_each(defs.begin(), defs.end(),
+        [&](std::string def){
+          known.erase(def);
+        });
+    });
+  return changed;
+};
+
+//Drops instructions that only write temporaries or HI/LO when nothing reads them on any path. Leaving
+//the unit by a branch to somewhere else or an indirect jump counts as reading everything.
+bool removeDeadCode(CodeUnit &unit){
+  int size=unit.lines.size();
+  std::map<std::string, int> targets;
+  for(int i=0;i<size;++i){
+    std::for_each(unit.lines[i].labels.begin(), unit.lines[i].labels.end(),
+      [&](std::string label){
+        targets[label]=i;
+      });
+  }
+  auto temporary=[](std::string reg){
+    if(reg=="hilo"){
+      return true;
+    }
+    if(reg.size()<2||reg[0]!='$'||!isdigit(reg[1])){
+      return false;
+    }
+    int num=std::stoi(reg.substr(1));
+    return num>=8&&num<=25;
+  };
+  std::vector<std::set<std::string>> liveIn(size+1), liveOut(size);
+  bool changed=true;
+  while(changed){
+    changed=false;
+    for(int i=size-1;i>=0;--i){
+      auto &line=unit.lines[i];
+      std::set<std::string> out;
+      bool falls=true;
+      if(line.isInstr()&&line.isTerminator()&&line.op!="syscall"&&line.op!="jal"){
+        falls=(line.op!="j"&&line.op!="jr");
+        auto target=targets.find(line.args.back());
+        if(line.op=="jr"){
+          if(line.args[0]!="$ra"){
+            out.insert("*");
+          }
+        }
+        else if(target!=targets.end()){
+          out.insert(liveIn[target->second].begin(), liveIn[target->second].end());
+        }
+        else{
+          out.insert("*");
+        }
+      }
+      if(falls){
+        out.insert(liveIn[i+1].begin(), liveIn[i+1].end());
+      }
+      auto in=out;
+      std::vector<std::string> defs, uses;
+      int mem, offset;
+      std::string base;
+      if(!line.isInstr()){
+      }
+      else if(line.operands(defs, uses, mem, base, offset)){
+        std::for_each(defs.begin(), defs.end(),
+          [&](std::string def){
+            in.erase(def);
+          });
+        in.insert(uses.begin(), uses.end());
+      }
+      else if(line.isTerminator()){
+        std::for_each(line.args.begin(), line.args.end(),
+          [&](std::string arg){
+            if(arg[0]=='$'){
+              in.insert(arg);
+            }
+          });
+      }
+      else{
+        in.insert("*");
+      }
+      liveOut[i]=out;
+      if(in!=liveIn[i]){
+        liveIn[i]=in;
+        changed=true;
+      }
+    }
+  }
+  bool removed=false;
+  for(int i=0;i<size;++i){
+    auto &line=unit.lines[i];
+    std::vector<std::string> defs, uses;
+    int mem, offset;
+    std::string base;
+    if(!line.operands(defs, uses, mem, base, offset)||line.op=="sw"||defs.empty()||liveOut[i].count("*")){
+      continue;
+    }
+    if(std::all_of(defs.begin(), defs.end(),
+      [&](std::string def){
+        return temporary(def)&&!liveOut[i].count(def);
+      })){
+      line.dropInstr();
+      removed=true;
+    }
+  }
+  return removed;
+};
+
+//Pure functions' code is kept so calls to them with constant arguments can be run while compiling
+void addPureCode(std::string code){
+  CodeUnit unit("pure", code);
+  for(int i=0;i<unit.lines.size();++i){
+    auto &line=unit.lines[i];
+    std::for_each(line.labels.begin(), line.labels.end(),
+      [&](std::string label){
+        pureLabels[label]=((line.data)?(pureDataEnd):(pureCodeBase+4*(int)(pureLines.size()+i)));
+      });
+    if(!line.data||line.op!=".word"){
+      continue;
+    }
+    std::stringstream words(line.args[0]);
+    std::string word;
+    while(std::getline(words, word, ',')){
+      word.erase(0, word.find_first_not_of(" \t"));
+      word.erase(word.find_last_not_of(" \t")+1);
+      pureWords.push_back(std::make_pair(pureDataEnd, word));
+      pureDataEnd+=4;
+    }
+  }
+  pureLines.insert(pureLines.end(), unit.lines.begin(), unit.lines.end());
+  //Words naming a label that isn't defined yet wait for the code that defines it
+  pureWords.erase(std::remove_if(pureWords.begin(), pureWords.end(),
+    [&](std::pair<int, std::string> word){
+      if(pureLabels.find(word.second)!=pureLabels.end()){
+        pureData[word.first]=pureLabels.at(word.second);
+        return true;
+      }
+      if(isImmediate(word.second)){
+        pureData[word.first]=std::stoi(word.second);
+        return true;
+      }
+      return false;
+    }), pureWords.end());
+};
+
+//Runs pure code from entry with the arguments stored in a frame at $gp+frame and gives back $v0 once it
+//returns. Code addresses are line numbers so jump tables work. Anything pure code doesn't do, a label
+//that isn't there or running more than evalBudget instructions gives up, and the call is compiled as usual.
+bool evaluate(std::string entry, int frame, std::vector<std::pair<int, int>> args, int &result){
+  const int codeBase=pureCodeBase, dataBase=pureDataBase, returnAddress=-4;
+  if(!pureWords.empty()){
+    return false;
+  }
+  auto &labels=pureLabels;
+  auto memory=pureData;
+  std::map<std::string, int> regs;
+  regs["$gp"]=dataBase+0x8000;
+  regs["$sp"]=0x7ffff000;
+  regs["$fp"]=regs["$gp"]+frame;
+  regs["$ra"]=returnAddress;
+  std::for_each(args.begin(), args.end(),
+    [&](std::pair<int, int> arg){
+      memory[regs["$fp"]+arg.first]=arg.second;
+    });
+  int hi=0, lo=0;
+  auto reg=[&](std::string name){
+    return ((name=="$zero")?(0):(regs[name]));
+  };
+  auto value=[&](std::string arg, int &val){
+    if(arg[0]=='$'){
+      val=reg(arg);
+      return true;
+    }
+    if(isImmediate(arg)){
+      val=std::stoi(arg);
+      return true;
+    }
+    return false;
+  };
+  auto address=[&](std::string arg, int &addr){
+    auto paren=arg.find('(');
+    if(paren==std::string::npos||!isImmediate(arg.substr(0, paren))){
+      return false;
+    }
+    addr=std::stoi(arg.substr(0, paren))+reg(arg.substr(paren+1, arg.find(')')-paren-1));
+    return true;
+  };
+  auto jump=[&](int target, int &pc){
+    if(target<codeBase||target>=codeBase+4*(int)pureLines.size()||(target-codeBase)%4!=0){
+      return false;
+    }
+    pc=(target-codeBase)/4;
+    return true;
+  };
+  auto start=labels.find(entry);
+  int pc;
+  if(start==labels.end()||!jump(start->second, pc)){
+    return false;
+  }
+  for(int steps=0;steps<evalBudget;++steps){
+    if(pc>=pureLines.size()){
+      return false;
+    }
+    auto &line=pureLines[pc];
+    if(line.data||!line.isInstr()){
+      ++pc;
+      continue;
+    }
+    auto &op=line.op;
+    auto &args=line.args;
+    int left, right, val, next=pc+1;
+    if(op=="jr"){
+      if(reg(args[0])==returnAddress){
+        result=reg("$v0");
+        return true;
+      }
+      if(!jump(reg(args[0]), next)){
+        return false;
+      }
+    }
+    else if(op=="j"||op=="jal"){
+      if(labels.find(args[0])==labels.end()||!jump(labels[args[0]], next)){
+        return false;
+      }
+      if(op=="jal"){
+        regs["$ra"]=codeBase+4*(pc+1);
+      }
+    }
+    else if(op=="beq"||op=="bne"){
+      if(!value(args[0], left)||!value(args[1], right)||labels.find(args[2])==labels.end()){
+        return false;
+      }
+      if((left==right)==(op=="beq")&&!jump(labels[args[2]], next)){
+        return false;
+      }
+    }
+    else if(op=="li"&&value(args[1], val)){
+      regs[args[0]]=val;
+    }
+    else if(op=="la"&&labels.find(args[1])!=labels.end()){
+      regs[args[0]]=labels[args[1]];
+    }
+    else if(op=="lw"&&address(args[1], val)){
+      regs[args[0]]=memory[val];
+    }
+    else if(op=="sw"&&address(args[1], val)){
+      memory[val]=reg(args[0]);
+    }
+    else if(op=="mult"){
+      long long product=(long long)reg(args[0])*reg(args[1]);
+      lo=(int)product;
+      hi=(int)(product>>32);
+    }
+    else if(op=="div"){
+      left=reg(args[0]);
+      right=reg(args[1]);
+      if(right==0||(left==INT_MIN&&right==-1)){
+        return false;
+      }
+      lo=left/right;
+      hi=left%right;
+    }
+    else if(op=="mfhi"||op=="mflo"){
+      regs[args[0]]=((op=="mfhi")?(hi):(lo));
+    }
+    else if(args.size()==3&&value(args[1], left)&&value(args[2], right)&&aluValue(op, left, right, val)){
+      regs[args[0]]=val;
+    }
+    else if(args.size()==2&&value(args[1], left)&&aluValue(op, left, 0, val)){
+      regs[args[0]]=val;
+    }
+    else{
+      return false;
+    }
+    pc=next;
+  }
+  return false;
+};
+
+//Drops the labels nothing in the unit refers to besides its entry, so what follows them can be found unreachable
+bool removeUnusedLabels(CodeUnit &unit, std::string entry){
+  std::set<std::string> used={entry};
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      if(line.data&&line.op==".word"){
+        std::stringstream words(line.args[0]);
+        std::string word;
+        while(std::getline(words, word, ',')){
+          word.erase(0, word.find_first_not_of(" \t"));
+          used.insert(word);
+        }
+      }
+      else if(line.isInstr()&&!line.args.empty()){
+        used.insert(line.args.back());
+      }
+    });
+  bool changed=false;
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      auto size=line.labels.size();
+      line.labels.erase(std::remove_if(line.labels.begin(), line.labels.end(),
+        [&](std::string label){
+          return !used.count(label);
+        }), line.labels.end());
+      if(line.labels.size()!=size){
+        line.setRaw();
+        changed=true;
+      }
+    });
+  return changed;
+};
+
+//A copy of the procedure at entry in which the parameters at the given frame offsets hold constants. It's
+//entered at label and its own labels are prefixed with it, but calls back to entry go to the general version.
+//Loads of those parameters from the procedure's own frame become constants, which are then folded through
+//the copy, and whatever that makes dead or unreachable is removed.
+std::string specialize(std::string code, std::string entry, std::string label, std::map<int, int> consts){
+  CodeUnit unit(label, code);
+  std::set<std::string> defined;
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      defined.insert(line.labels.begin(), line.labels.end());
+    });
+  auto rename=[&](std::string name){
+    return ((name==entry)?(label):((defined.count(name))?(label+name):(name)));
+  };
+  bool ownFrame=true;
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      std::transform(line.labels.begin(), line.labels.end(), line.labels.begin(), rename);
+      if(!line.labels.empty()){
+        ownFrame=true;
+      }
+      auto &op=line.op;
+      auto &args=line.args;
+      if(line.data&&op==".word"){
+        std::stringstream words(args[0]);
+        std::string word, renamed;
+        while(std::getline(words, word, ',')){
+          word.erase(0, word.find_first_not_of(" \t"));
+          renamed+=((renamed.empty())?(""):(", "))+rename(word);
+        }
+        args[0]=renamed;
+      }
+      else if((op=="j"||op=="jal")&&args[0]!=entry){
+        args[0]=rename(args[0]);
+      }
+      else if(op=="beq"||op=="bne"){
+        args[2]=rename(args[2]);
+      }
+      else if(op=="la"){
+        args[1]=rename(args[1]);
+      }
+      else if(op=="lw"&&ownFrame&&args[1].size()>5&&args[1].substr(args[1].size()-5)=="($fp)"){
+        auto slot=consts.find(std::stoi(args[1]));
+        if(slot!=consts.end()){
+          op="li";
+          args[1]=std::to_string(slot->second);
+        }
+      }
+      //A call points $fp at the callee's frame until it's restored from the stack
+      if(line.isInstr()&&!args.empty()&&args[0]=="$fp"&&op!="sw"){
+        ownFrame=(op=="lw");
+      }
+      line.setRaw();
+    });
+  bool changed=true;
+  while(changed){
+    changed=foldConstants(unit);
+    changed=removeUnusedLabels(unit, label)||changed;
+    changed=removeUnreachable(unit)||changed;
+    changed=removeJumpsToNext(unit)||changed;
+    changed=removeSelfMoves(unit)||changed;
+    changed=removeDeadCode(unit)||changed;
+  }
+  return unit.str();
+};
+
+//Optimizes a unit and renders it for the selected target. The workers run this whole step, so only
+//concatenating the results is left serial.
+void lower(CodeUnit &unit){
+  optimize(unit);
+  unit.text=((native)?(x86Unit(unit)):(unit.str()));
+};
+
+void openOutput(std::string file){
+  output.open(file.data(), std::ios::out);
+  if(native){
+    output<<x86Header();
+  }
+};
+
+//Everything emitted since the last unit ended becomes one unit. Tail calls can rewind emit,
+//so only what's before the put position counts.
+void endUnit(std::string name){
+  auto code=emit.str().substr(0, emit.tellp());
+  emit.str("");
+  emit.clear();
+  if(code.empty()){
+    return;
+  }
+  CodeUnit unit(name, code);
+  if(threads>0){
+    units.push_back(unit);
+    return;
+  }
+  lower(unit);
+  if(verbose){
+    std::cout<<"Scheduled "<<unit.name<<": "<<unit.cyclesBefore<<" -> "<<unit.cyclesAfter<<" cycles"<<std::endl;
+  }
+  output<<unit.text;
+  if(streaming){
+    output.flush();
+  }
+};
+
+void closeOutput(){
+  endUnit("end");
+  if(threads>0&&units.size()>0){
+    runParallel(units, std::min<int>(threads, units.size()));
+    std::for_each(units.begin(), units.end(),
+      [&](CodeUnit &unit){
+        if(verbose){
+          std::cout<<"Scheduled "<<unit.name<<": "<<unit.cyclesBefore<<" -> "<<unit.cyclesAfter<<" cycles"<<std::endl;
+        }
+        output<<unit.text;
+      });
+    units.clear();
+  }
+  if(native){
+    output<<x86Runtime();
+  }
+  output.close();
+};
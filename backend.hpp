@@ -0,0 +1,73 @@
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <map>
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+class Line{
+  public:
+    std::vector<std::string> labels;
+    std::string op;
+    std::vector<std::string> args;
+    std::string raw;
+    bool data;
+    Line(std::string raw, bool data=false);
+    bool isInstr();
+    bool isTerminator();
+    bool operands(std::vector<std::string> &defs, std::vector<std::string> &uses, int &mem, std::string &base, int &offset);
+    int latency();
+    void dropInstr();
+    void setRaw();
+};
+
+//Cycles from issue until a result can be used, for a single issue in-order core
+class LatencyModel{
+  public:
+    int load;
+    int mult;
+    int div;
+    LatencyModel(int load=2, int mult=5, int div=20):load(load)
+    ,mult(mult)
+    ,div(div)
+    {};
+};
+
+class CodeUnit{
+  public:
+    std::string name;
+    std::vector<Line> lines;
+    int labelCount;
+    int cyclesBefore;
+    int cyclesAfter;
+    //The unit's final assembly, MIPS or x86, once lower() has run
+    std::string text;
+    CodeUnit(std::string name, std::string code);
+    std::string newLabel();
+    std::string str();
+};
+
+void optimize(CodeUnit &unit);
+void lower(CodeUnit &unit);
+bool removeUnreachable(CodeUnit &unit);
+bool removeJumpsToNext(CodeUnit &unit);
+bool removeSelfMoves(CodeUnit &unit);
+void schedule(CodeUnit &unit);
+void scheduleBlock(CodeUnit &unit, std::vector<int> &block, int &before, int &after);
+void runParallel(std::vector<CodeUnit> &units, int threads);
+bool aluValue(std::string op, int left, int right, int &result);
+bool foldConstants(CodeUnit &unit);
+bool removeDeadCode(CodeUnit &unit);
+void addPureCode(std::string code);
+bool evaluate(std::string entry, int frame, std::vector<std::pair<int, int>> args, int &result);
+std::string specialize(std::string code, std::string entry, std::string label, std::map<int, int> consts);
+
+void openOutput(std::string file);
+void endUnit(std::string name);
+void closeOutput();
+
+#endif
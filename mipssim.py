@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Runs the MIPS subset the compiler emits and counts cycles on a single-issue machine that stalls until
+an operand is ready, with the scheduler's default latencies. Usage: mipssim.py file.cpsl [input...]
+The program's output goes to stdout and the instruction and cycle counts to stderr."""
+import sys, re
+REGN={'zero':0,'at':1,'v0':2,'v1':3,'a0':4,'a1':5,'a2':6,'a3':7,'gp':28,'sp':29,'fp':30,'ra':31,'k0':26,'k1':27}
+for i in range(8): REGN['t%d'%i]=8+i; REGN['s%d'%i]=16+i
+REGN['t8']=24; REGN['t9']=25
+def reg(s):
+    s=s.strip().lstrip('$'); return int(s) if s.isdigit() else REGN[s]
+def s32(v):
+    v&=0xffffffff; return v-(1<<32) if v&0x80000000 else v
+src=open(sys.argv[1]).read().split('\n')
+inputs=sys.argv[2:]
+text=[];labels={};data={};mem={};seg='text';daddr=0x10010000
+for line in src:
+    line=line.split('#')[0].strip()
+    while True:
+        m=re.match(r'^([A-Za-z_.$][\w.$]*):\s*(.*)$',line)
+        if not m: break
+        if seg=='text': labels[m.group(1)]=len(text)
+        else: labels[m.group(1)]=daddr
+        line=m.group(2).strip()
+    if not line: continue
+    if line.startswith('.text'): seg='text'; continue
+    if line.startswith('.data'): seg='data'; continue
+    if line.startswith('.globl'): continue
+    if seg=='data':
+        if line.startswith('.asciiz'):
+            s=line[len('.asciiz'):].strip()
+            s=bytes(s[1:-1],'latin1').decode('unicode_escape')
+            for ch in s: mem[daddr]=ord(ch); daddr+=1
+            mem[daddr]=0; daddr+=1
+        elif line.startswith('.word'):
+            daddr=(daddr+3)&~3
+            for w in line[5:].split(','):
+                w=w.strip(); mem[daddr]=('L',w); daddr+=4
+        elif line.startswith('.space'):
+            daddr+=int(line.split()[1])
+        elif line.startswith('.align'): daddr=(daddr+3)&~3
+        continue
+    m=re.match(r'^(\S+)\s*(.*)$',line)
+    op=m.group(1); args=[a.strip() for a in m.group(2).split(',')] if m.group(2) else []
+    text.append((op,args))
+R=[0]*32; R[29]=0x7ffff000; R[28]=0x10008000
+hi=lo=0; pc=0
+out=[]; count=0; cycles=0; READY={}; status=0
+def ld(addr):
+    v=mem.get(addr,0)
+    if isinstance(v,tuple): return labels[v[1]]
+    return v
+def val(a):
+    a=a.strip()
+    if a.startswith('$'): return R[reg(a)]
+    return int(a,0)
+def memop(a):
+    m=re.match(r'^(-?\w*)\((\$\w+)\)$',a)
+    off=int(m.group(1),0) if m.group(1) else 0
+    return R[reg(m.group(2))]+off
+LIMIT=int(__import__('os').environ.get('SIMLIMIT','50000000'))
+while True:
+    if pc>=len(text): break
+    op,a=text[pc]; pc+=1; count+=1
+    if count>LIMIT: print('\n[LIMIT]'); break
+    # cycle model: single issue, stall until operands ready
+    LAT={'lw':2,'mult':5,'div':20}
+    regs=[x for x in a if x.startswith('$')]+[re.sub(r'.*\((.*)\)',r'\1',x) for x in a if '(' in x]
+    if op in('mult','div'): uses=regs; dst=['hilo']
+    elif op in('mfhi','mflo'): uses=['hilo']; dst=regs
+    elif op=='sw' or op[0] in 'bj' or op=='syscall': uses=regs+(['$v0','$a0'] if op=='syscall' else []); dst=[]
+    else: uses=regs[1:]; dst=regs[:1]
+    t=max([cycles]+[READY.get(u,0) for u in uses])
+    for d in dst: READY[d]=t+LAT.get(op,1)
+    cycles=t+1
+    def w(d,v):
+        if reg(d)!=0: R[reg(d)]=s32(v)
+    if op=='li': w(a[0],int(a[1],0))
+    elif op=='la': w(a[0],labels[a[1]])
+    elif op=='move': w(a[0],R[reg(a[1])])
+    elif op in('add','addu'): w(a[0],val(a[1])+val(a[2]))
+    elif op in('addi','addiu'): w(a[0],val(a[1])+int(a[2],0))
+    elif op in('sub','subu'): w(a[0],val(a[1])-val(a[2]))
+    elif op in('and','andi'): w(a[0],val(a[1])&val(a[2]))
+    elif op in('or','ori'): w(a[0],val(a[1])|val(a[2]))
+    elif op in('xor','xori'): w(a[0],val(a[1])^val(a[2]))
+    elif op=='nor': w(a[0],~(val(a[1])|val(a[2])))
+    elif op=='not': w(a[0],~val(a[1]))
+    elif op=='neg': w(a[0],-val(a[1]))
+    elif op in('slt','slti'): w(a[0],int(val(a[1])<val(a[2])))
+    elif op in('sltu','sltiu'): w(a[0],int((val(a[1])&0xffffffff)<(val(a[2])&0xffffffff)))
+    elif op=='sgt': w(a[0],int(val(a[1])>val(a[2])))
+    elif op=='sge': w(a[0],int(val(a[1])>=val(a[2])))
+    elif op=='sle': w(a[0],int(val(a[1])<=val(a[2])))
+    elif op=='seq': w(a[0],int(val(a[1])==val(a[2])))
+    elif op=='sne': w(a[0],int(val(a[1])!=val(a[2])))
+    elif op in('sll','sllv'): w(a[0],val(a[1])<<(val(a[2])&31))
+    elif op in('sra','srav'): w(a[0],val(a[1])>>(val(a[2])&31))
+    elif op in('srl','srlv'): w(a[0],(val(a[1])&0xffffffff)>>(val(a[2])&31))
+    elif op=='mul': w(a[0],val(a[1])*val(a[2]))
+    elif op=='mult':
+        p=val(a[0])*val(a[1]); lo=s32(p); hi=s32(p>>32)
+    elif op=='div':
+        x,y=val(a[0]),val(a[1])
+        q=abs(x)//abs(y); q=q if (x<0)==(y<0) else -q
+        lo=s32(q); hi=s32(x-q*y)
+    elif op=='mflo': w(a[0],lo)
+    elif op=='mfhi': w(a[0],hi)
+    elif op=='lw': w(a[0],ld(memop(a[1])))
+    elif op=='sw': mem[memop(a[1])]=R[reg(a[0])]
+    elif op=='j': pc=labels[a[0]]
+    elif op=='jal': R[31]=pc; pc=labels[a[0]]
+    elif op=='jr': pc=R[reg(a[0])]
+    elif op=='beq':
+        if val(a[0])==val(a[1]): pc=labels[a[2]]
+    elif op=='bne':
+        if val(a[0])!=val(a[1]): pc=labels[a[2]]
+    elif op in('blt','bgt','ble','bge','bltu','bgeu'):
+        x,y=val(a[0]),val(a[1])
+        if op.endswith('u'): x&=0xffffffff; y&=0xffffffff
+        c={'blt':x<y,'bgt':x>y,'ble':x<=y,'bge':x>=y,'bltu':x<y,'bgeu':x>=y}[op]
+        if c: pc=labels[a[2]]
+    elif op=='beqz':
+        if val(a[0])==0: pc=labels[a[1]]
+    elif op=='bnez':
+        if val(a[0])!=0: pc=labels[a[1]]
+    elif op=='nop': pass
+    elif op=='syscall':
+        v=R[2]
+        if v==1: out.append(str(R[4]))
+        elif v==4:
+            p=R[4]
+            while mem.get(p,0): out.append(chr(mem[p])); p+=1
+        elif v==11: out.append(chr(R[4]&0xff))
+        elif v==5: R[2]=int(inputs.pop(0))
+        elif v==12: R[2]=ord(inputs.pop(0)[0])
+        elif v==10: break
+        elif v==17: status=R[4]; break
+    else:
+        print('UNKNOWN OP',op,a); sys.exit(2)
+sys.stdout.write(''.join(out))
+sys.stderr.write('\n[instructions: %d] [cycles: %d] [sp: %x]\n'%(count,cycles,R[29]))
+sys.exit(status)
@@ -0,0 +1,249 @@
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "symboltable.hpp"
+#include "module.hpp"
+
+template <class T>
+void writeTable(std::ofstream &file, std::vector<T> &table){
+  file.write((char*)table.data(), table.size()*sizeof(T));
+};
+
+//Writes the outer scope as it stands after the declarations. Procedure bodies can't be carried in an
+//interface, so only FORWARD declarations are allowed and importers supply the definitions.
+void exportModule(std::string file){
+  auto table=SymbolTable::getInstance();
+  std::string strings;
+  auto addString=[&](std::string str){
+    int temp=strings.size();
+    strings+=str;
+    strings+='\0';
+    return temp;
+  };
+  std::vector<ModuleType> types;
+  std::vector<ModuleField> fields;
+  std::vector<ModuleParam> params;
+  std::vector<ModuleName> names;
+  std::vector<ModuleConst> consts;
+  std::vector<ModuleVar> vars;
+  std::vector<ModuleFunc> funcs;
+  std::for_each(table->types.begin(), table->types.end(),
+    [&](std::shared_ptr<Type> type){
+      ModuleType temp={(int32_t)type->typeType, 0, -1, 0, 0, 0, 0, addString(type->name)};
+      if(auto simple=dynamic_cast<Simple*>(type.get())){
+        temp.simType=simple->simType;
+      }
+      if(auto arr=dynamic_cast<Array*>(type.get())){
+        temp.elem=arr->type->id;
+        temp.lower=arr->lower;
+        temp.upper=arr->upper;
+      }
+      if(auto rec=dynamic_cast<Record*>(type.get())){
+        std::vector<std::pair<int, ModuleField>> layout;
+        std::for_each(rec->layout.begin(), rec->layout.end(),
+          [&](std::pair<std::string, std::pair<std::shared_ptr<Type>, int>> val){
+            ModuleField field={addString(val.first), val.second.first->id, val.second.second};
+            layout.push_back(std::make_pair(val.second.second, field));
+          });
+        //Importers rebuild the layout by laying the fields out in order
+        std::sort(layout.begin(), layout.end(),
+          [&](const std::pair<int, ModuleField> &left, const std::pair<int, ModuleField> &right){
+            return left.first<right.first;
+          });
+        temp.firstField=fields.size();
+        temp.fieldCount=layout.size();
+        std::for_each(layout.begin(), layout.end(),
+          [&](std::pair<int, ModuleField> val){
+            fields.push_back(val.second);
+          });
+      }
+      types.push_back(temp);
+    });
+  std::for_each(table->tables[1].begin(), table->tables[1].end(),
+    [&](std::pair<std::string, std::shared_ptr<Symbol>> val){
+      if(auto type=dynamic_cast<Type*>(val.second.get())){
+        ModuleName temp={addString(val.first), type->id};
+        names.push_back(temp);
+      }
+      else if(auto con=dynamic_cast<Const*>(val.second.get())){
+        //A constant naming another one is exported with that one's value
+        auto value=*con;
+        resolveConst(value);
+        ModuleConst temp={addString(val.first), (int32_t)value.type, 0, -1};
+        switch(value.type){
+          case Const::intType: temp.val=value.numVal; break;
+          case Const::charType: temp.val=value.charVal; break;
+          case Const::booleanType: temp.val=value.boolVal; break;
+          case Const::stringType: temp.str=addString(value.strVal); break;
+          case Const::identType: yyerror((val.first+" cannot be exported\n").data());
+        }
+        consts.push_back(temp);
+      }
+      else if(auto var=dynamic_cast<Var*>(val.second.get())){
+        ModuleVar temp={addString(val.first), var->type->id, var->location};
+        vars.push_back(temp);
+      }
+      else if(auto func=dynamic_cast<Function*>(val.second.get())){
+        if(func->defined){
+          yyerror("Declaration modules can only contain FORWARD procedures\n");
+        }
+        ModuleFunc temp={addString(val.first), ((func->funcType==Function::function)?(func->returnType->id):(-1)), (int32_t)params.size(), 0};
+        for(int i=0;i<func->typeList.size();++i){
+          for(int j=0;j<func->typeList[i].first.size();++j){
+            ModuleParam param={addString(func->typeList[i].first[j]), func->typeList[i].second->id, j==0, func->byRef(i)};
+            params.push_back(param);
+          }
+        }
+        temp.paramCount=params.size()-temp.firstParam;
+        funcs.push_back(temp);
+      }
+    });
+  ModuleHeader header;
+  std::memcpy(header.magic, MODULE_MAGIC, 4);
+  header.version=MODULE_VERSION;
+  header.globalSize=table->offset[1];
+  header.typeCount=types.size();
+  header.fieldCount=fields.size();
+  header.paramCount=params.size();
+  header.nameCount=names.size();
+  header.constCount=consts.size();
+  header.varCount=vars.size();
+  header.funcCount=funcs.size();
+  header.stringSize=strings.size();
+  header.size=sizeof(ModuleHeader)+types.size()*sizeof(ModuleType)+fields.size()*sizeof(ModuleField)
+    +params.size()*sizeof(ModuleParam)+names.size()*sizeof(ModuleName)+consts.size()*sizeof(ModuleConst)
+    +vars.size()*sizeof(ModuleVar)+funcs.size()*sizeof(ModuleFunc)+strings.size();
+  std::ofstream out(file.data(), std::ios::out|std::ios::binary);
+  if(!out){
+    yyerror(std::string("Can't write module "+file+"\n").data());
+  }
+  out.write((char*)&header, sizeof(ModuleHeader));
+  writeTable(out, types);
+  writeTable(out, fields);
+  writeTable(out, params);
+  writeTable(out, names);
+  writeTable(out, consts);
+  writeTable(out, vars);
+  writeTable(out, funcs);
+  out.write(strings.data(), strings.size());
+};
+
+//Maps an interface and adds its symbols to the outer scope. Vars are moved past the globals already there,
+//and the frames of imported procedures are placed once the importer's own globals are known.
+bool importModule(std::string file){
+  int fd=open(file.data(), O_RDONLY);
+  if(fd<0){
+    return false;
+  }
+  struct stat info;
+  if(fstat(fd, &info)<0||info.st_size<sizeof(ModuleHeader)){
+    close(fd);
+    return false;
+  }
+  auto base=(char*)mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(base==MAP_FAILED){
+    return false;
+  }
+  auto header=(ModuleHeader*)base;
+  if(std::memcmp(header->magic, MODULE_MAGIC, 4)!=0||header->version!=MODULE_VERSION||header->size!=info.st_size
+    ||header->stringSize<=0||base[header->size-1]!='\0'){
+    munmap(base, info.st_size);
+    return false;
+  }
+  auto types=(ModuleType*)(base+sizeof(ModuleHeader));
+  auto fields=(ModuleField*)(types+header->typeCount);
+  auto params=(ModuleParam*)(fields+header->fieldCount);
+  auto names=(ModuleName*)(params+header->paramCount);
+  auto consts=(ModuleConst*)(names+header->nameCount);
+  auto vars=(ModuleVar*)(consts+header->constCount);
+  auto funcs=(ModuleFunc*)(vars+header->varCount);
+  auto strings=(char*)(funcs+header->funcCount);
+  if(strings+header->stringSize!=base+header->size){
+    munmap(base, info.st_size);
+    return false;
+  }
+  auto table=SymbolTable::getInstance();
+  std::vector<std::shared_ptr<Type>> typeMap;
+  auto check=[&](int index, int count){
+    if(index<0||index>=count){
+      yyerror(std::string("Corrupt module "+file+"\n").data());
+    }
+    return index;
+  };
+  auto getType=[&](int id){
+    return typeMap[check(id, typeMap.size())];
+  };
+  auto getString=[&](int offset){
+    return std::string(strings+check(offset, header->stringSize));
+  };
+  auto define=[&](std::string name, std::shared_ptr<Symbol> sym){
+    if(table->tables.back().find(name)!=table->tables.back().end()){
+      yyerror(std::string(name+" already defined\n").data());
+    }
+    table->tables.back().insert(std::make_pair(name, sym));
+  };
+  for(int i=0;i<header->typeCount;++i){
+    std::shared_ptr<Type> temp;
+    switch(types[i].typeType){
+      case Type::array:
+        temp=std::make_shared<Array>(getType(types[i].elem).get(), Const(types[i].lower), Const(types[i].upper));
+        break;
+      case Type::record:{
+        std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList;
+        for(int j=types[i].firstField;j<types[i].firstField+types[i].fieldCount;++j){
+          typeList.push_back(std::make_pair(std::vector<std::string>(1, getString(fields[check(j, header->fieldCount)].name)), getType(fields[j].type)));
+        }
+        temp=std::make_shared<Record>(typeList);
+        break;
+      }
+      default:
+        temp=std::make_shared<Simple>((Simple::simpleType)types[i].simType);
+    }
+    temp=table->internType(temp);
+    if(temp->name==""){
+      temp->name=getString(types[i].name);
+    }
+    typeMap.push_back(temp);
+  }
+  for(int i=0;i<header->nameCount;++i){
+    define(getString(names[i].name), getType(names[i].type));
+  }
+  for(int i=0;i<header->constCount;++i){
+    auto name=getString(consts[i].name);
+    switch(consts[i].type){
+      case Const::intType: define(name, std::make_shared<Const>((int)consts[i].val, name)); break;
+      case Const::charType: define(name, std::make_shared<Const>((char)consts[i].val, name)); break;
+      case Const::booleanType: define(name, std::make_shared<Const>((bool)consts[i].val, name)); break;
+      default: define(name, std::make_shared<Const>(getString(consts[i].str), name));
+    }
+  }
+  int globalBase=table->offset.back();
+  for(int i=0;i<header->varCount;++i){
+    auto name=getString(vars[i].name);
+    define(name, std::make_shared<Var>(getType(vars[i].type), globalBase+vars[i].location, name));
+  }
+  table->offset.back()+=header->globalSize;
+  for(int i=0;i<header->funcCount;++i){
+    std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList;
+    std::vector<bool> refs;
+    for(int j=funcs[i].firstParam;j<funcs[i].firstParam+funcs[i].paramCount;++j){
+      check(j, header->paramCount);
+      if(params[j].newGroup||typeList.empty()){
+        typeList.push_back(std::make_pair(std::vector<std::string>(), getType(params[j].type)));
+        refs.push_back(params[j].byRef);
+      }
+      typeList.back().first.push_back(getString(params[j].name));
+    }
+    auto name=getString(funcs[i].name);
+    auto func=((funcs[i].returnType>=0)?(std::make_shared<Function>(name, getType(funcs[i].returnType), typeList)):(std::make_shared<Function>(name, typeList)));
+    func->refs=refs;
+    define(name, func);
+    table->imported.push_back(func);
+  }
+  munmap(base, info.st_size);
+  return true;
+};
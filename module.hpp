@@ -0,0 +1,81 @@
+#include <string>
+#include <cstdint>
+
+#ifndef MODULE_H_
+#define MODULE_H_
+
+#define MODULE_MAGIC "CPSI"
+#define MODULE_VERSION 2
+
+//Interface files are a header followed by each record table in the order the counts are listed, then
+//the string table. Every field is a 32 bit int so the tables can be used in place from an mmap.
+//Names are offsets into the string table and types are indices into the type table, which is in
+//dependency order.
+struct ModuleHeader{
+  char magic[4];
+  int32_t version;
+  int32_t size;
+  int32_t globalSize;
+  int32_t typeCount;
+  int32_t fieldCount;
+  int32_t paramCount;
+  int32_t nameCount;
+  int32_t constCount;
+  int32_t varCount;
+  int32_t funcCount;
+  int32_t stringSize;
+};
+
+struct ModuleType{
+  int32_t typeType;
+  int32_t simType;
+  int32_t elem;
+  int32_t lower;
+  int32_t upper;
+  int32_t firstField;
+  int32_t fieldCount;
+  int32_t name;
+};
+
+struct ModuleField{
+  int32_t name;
+  int32_t type;
+  int32_t offset;
+};
+
+struct ModuleParam{
+  int32_t name;
+  int32_t type;
+  int32_t newGroup;
+  int32_t byRef;
+};
+
+struct ModuleName{
+  int32_t name;
+  int32_t type;
+};
+
+struct ModuleConst{
+  int32_t name;
+  int32_t type;
+  int32_t val;
+  int32_t str;
+};
+
+struct ModuleVar{
+  int32_t name;
+  int32_t type;
+  int32_t location;
+};
+
+struct ModuleFunc{
+  int32_t name;
+  int32_t returnType;
+  int32_t firstParam;
+  int32_t paramCount;
+};
+
+void exportModule(std::string file);
+bool importModule(std::string file);
+
+#endif
@@ -1,17 +1,29 @@
-#include <fstream>
+#include <sstream>
+#include <climits>
 #include "symboltable.hpp"
+#include "backend.hpp"
 extern bool verbose;
-extern std::fstream emit;
+extern bool streaming;
+extern bool boundsCheck;
+extern int unrollBudget;
+extern int lineNum;
+extern std::stringstream emit;
+std::vector<Expression*> Expression::pool;
 
 Type::Type(std::string name, int size, TypeType typeType):Symbol(name)
 ,size(size)
 ,typeType(typeType)
+,id(-1)
 {};
 
 void Type::print(){
   std::cout<<"This shouldn't happen\n";
 };
 
+std::string Type::key(){
+  return name;
+};
+
 int Const::getIntVal(){
   if(type==intType){
     return numVal;
@@ -62,37 +74,67 @@ void Const::print(){
   };
 };
 
-Var::Var(Type type, int location, std::string name):Symbol(name)
-,type(std::make_shared<Type>(type))
-,location(location){
+Var::Var(std::shared_ptr<Type> type, int location, std::string name, bool ref):Symbol(name)
+,type(type)
+,location(location)
+,ref(ref)
+,written(false){
 };
 
 void Var::print(){
-  std::cout<<"Var "<<name<<" of type "<<type->name<<", location:"<<location<<std::endl;
+  std::cout<<((ref)?("VAR "):("Var "))<<name<<" of type "<<type->name<<", location:"<<location<<std::endl;
 };
 
-Function::Function(std::string name, Type returnType, std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, bool defined):Symbol(name)
+Function::Function(std::string name, std::shared_ptr<Type> returnType, std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, bool defined):Symbol(name)
 ,defined(defined)
 ,funcType(function)
+,compiled(false)
 ,typeList(typeList)
 ,location("__"+name)
 ,offset(0)
-,returnType(std::make_shared<Type>(returnType)){
+,returnType(returnType){
   this->name=name;
 };
 
 Function::Function(std::string name, std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, bool defined):Symbol(name)
 ,defined(defined)
 ,funcType(procedure)
+,compiled(false)
 ,typeList(typeList)
 ,location("__"+name)
 ,offset(0){
   this->name=name;
 };
 
+bool Function::byRef(int group){
+  return group<refs.size()&&refs[group];
+};
+
+//VAR parameters take one word for the address, value parameters are copied in whole
+int Function::paramSize(int group){
+  return ((byRef(group))?(4):(std::max(4, typeList[group].second->size)));
+};
+
+bool Function::scalarParams(){
+  for(int i=0;i<typeList.size();++i){
+    if(paramSize(i)!=4||byRef(i)){
+      return false;
+    }
+  }
+  return true;
+};
+
+//Pure functions can be run at compile time, so they take scalar values and touch nothing but their frame
+bool Function::pure(){
+  return funcType==function&&compiled&&scalarParams()&&!effects.writesMemory&&!effects.readsGlobals&&!effects.io&&!effects.unknownCalls;
+};
+
 void Function::print(){
   std::cout<<((funcType==Function::function)?("Function: "):("Procedure: "))<<name<<"(";
   for(int i=0;i<typeList.size();++i){
+    if(byRef(i)){
+      std::cout<<"VAR ";
+    }
     for(int j=0;j<typeList[i].first.size();++j){
       std::cout<<typeList[i].first[j];
       if(j==typeList[i].first.size()-1){
@@ -107,14 +149,19 @@ void Function::print(){
     std::cout<<"; ";
   }
   std::cout<<")"<<((funcType==Function::function)?("->"+returnType->name):(""))<<", location:"<<location<<", offset:"<<offset<<std::endl;
+  if(compiled){
+    std::cout<<"  "<<((pure())?("pure"):("impure"))<<((effects.writesMemory)?(", writes memory"):(""))
+      <<((effects.readsGlobals)?(", reads globals"):(""))<<((effects.io)?(", does I/O"):(""))
+      <<((effects.unknownCalls)?(", calls procedures not yet compiled"):(""))<<std::endl;
+  }
 };
 
-Array::Array(Type *type, Const lower, Const upper, std::string name):Type(name, type->size*(upper.getIntVal()-lower.getIntVal()), Type::array)
+Array::Array(Type *type, Const lower, Const upper, std::string name):Type(name, type->size*(upper.getIntVal()-lower.getIntVal()+1), Type::array)
 ,lower(lower.getIntVal())
 ,upper(upper.getIntVal())
-,type(std::make_shared<Type>(*type))
+,type(SymbolTable::getInstance()->getType(type->id))
 {
-  if(this->upper<=this->lower){
+  if(this->upper<this->lower){
     yyerror("Invalid array bounds");
   }
   this->name="Array["+std::to_string(this->lower)+":"+std::to_string(this->upper)+"] of "+type->name;
@@ -124,6 +171,10 @@ void Array::print(){
   std::cout<<"Type "<<name<<": Array "<<lower<<" to "<<upper<<" of "<<type->name<<", size:"<<size<<"\n";
 };
 
+std::string Array::key(){
+  return "Array["+std::to_string(lower)+":"+std::to_string(upper)+"] of #"+std::to_string(type->id);
+};
+
 Simple::Simple(simpleType simType, std::string name):Type(name, 4)
 ,simType(simType){};
 
@@ -137,6 +188,16 @@ void Simple::print(){
   }
 };
 
+std::string Simple::key(){
+  switch(simType){
+    case integer: return "integer";
+    case boolean: return "boolean";
+    case character: return "char";
+    case string: return "string";
+  }
+  return name;
+};
+
 Record::Record(std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, std::string name):Type(name, 0, Type::record){
   int offset=0;
   std::for_each(typeList.begin(), typeList.end(),
@@ -167,15 +228,61 @@ void Record::print(){
   std::cout<<"}"<<std::endl;
 };
 
+std::string Record::key(){
+  std::string key="Record{";
+  std::for_each(layout.begin(), layout.end(),
+    [&](std::pair<std::string, std::pair<std::shared_ptr<Type>, int>> val){
+      key+=val.first+":#"+std::to_string(val.second.first->id)+"@"+std::to_string(val.second.second)+";";
+    });
+  return key+"}";
+};
+
+//Every type is built once and shared, so equal types are the same object and compare by id
+std::shared_ptr<Type> SymbolTable::internType(std::shared_ptr<Type> type){
+  if(type->id>=0){
+    return types[type->id];
+  }
+  auto key=type->key();
+  if(typeIds.find(key)!=typeIds.end()){
+    return types[typeIds.at(key)];
+  }
+  type->id=types.size();
+  typeIds.insert(std::make_pair(key, type->id));
+  types.push_back(type);
+  return type;
+};
+
+std::shared_ptr<Type> SymbolTable::getType(int id){
+  if(id<0||id>=types.size()){
+    yyerror("Type not interned\n");
+  }
+  return types[id];
+};
+
+void SymbolTable::addType(std::string name, Type *type){
+  if(tables.back().find(name)!=tables.back().end()){
+    yyerror(std::string(name+" already defined\n").data());
+  }
+  auto temp=getType(type->id);
+  if(temp->name==""){
+    temp->name=name;
+  }
+  tables.back().insert(std::make_pair(name, temp));
+};
+
 void SymbolTable::pushScope(Function funcName){
   std::map<std::string, std::shared_ptr<Symbol>> temp;
   std::shared_ptr<Function> tempFunc=std::make_shared<Function>(funcName);
   tables.push_back(temp);
   offset.push_back(0);
+  funcStack.push_back(tempFunc);
+  typeMarks.push_back(types.size());
+  clearValues();
+  spillSlots.clear();
   for(int i=0;i<tempFunc->typeList.size();++i){
     for(int j=0;j<tempFunc->typeList[i].first.size();++j){
-      Var temp(*tempFunc->typeList[i].second, offset.back(), tempFunc->typeList[i].first[j]);
-      SymbolTable::getInstance()->offset.back()+=4;
+      Var temp(tempFunc->typeList[i].second, offset.back(), tempFunc->typeList[i].first[j], tempFunc->byRef(i));
+      SymbolTable::getInstance()->offset.back()+=tempFunc->paramSize(i);
       addSymbol(tempFunc->typeList[i].first[j], temp, true);
     }
   }
@@ -190,16 +297,75 @@ void SymbolTable::popScope(){
       });
     std::cout<<std::endl<<std::endl;
   }
+  auto unitName=((funcStack.back())?(funcStack.back()->name):(std::string("main")));
+  if(funcStack.back()){
+    auto func=dynamic_cast<Function*>(tables[tables.size()-2].at(unitName).get());
+    frameEnd=std::max(frameEnd, func->offset+offset.back());
+    func->effects=funcStack.back()->effects;
+    func->paramsWritten.clear();
+    std::for_each(func->typeList.begin(), func->typeList.end(),
+      [&](std::pair<std::vector<std::string>, std::shared_ptr<Type>> group){
+        std::for_each(group.first.begin(), group.first.end(),
+          [&](std::string name){
+            func->paramsWritten.push_back(dynamic_cast<Var*>(tables.back().at(name).get())->written);
+          });
+      });
+    func->compiled=true;
+    //Code is kept to specialize from when some parameter is never written: for every pure function, and
+    //for other procedures of up to 64 lines until 4096 lines are held in all. Holding every procedure's
+    //text would make memory grow with the program, which -s avoids.
+    func->code.clear();
+    auto code=emit.str().substr(0, emit.tellp());
+    int lines=std::count(code.begin(), code.end(), '\n');
+    if(func->pure()){
+      addPureCode(code);
+    }
+    if(std::count(func->paramsWritten.begin(), func->paramsWritten.end(), false)>0){
+      if(func->pure()){
+        func->code=code;
+      }
+      else if(lines<=64&&keptLines+lines<=4096){
+        func->code=code;
+        keptLines+=lines;
+      }
+    }
+  }
+  spillSlots.clear();
   tables.pop_back();
   offset.pop_back();
+  funcStack.pop_back();
+  clearValues();
+  lastCall.reset();
+  //Types built inside a scope can't be referenced once it's gone
+  for(int i=typeMarks.back();i<types.size();++i){
+    typeIds.erase(types[i]->key());
+  }
+  types.resize(typeMarks.back());
+  typeMarks.pop_back();
+  Expression::releasePool();
+  if(streaming){
+    emitStrings();
+  }
+  endUnit(unitName);
 };
 
 void SymbolTable::addFunction(std::string name, Function func, bool forward){
+  placeImports();
   if(tables.back().find(name)!=tables.back().end()){
     if(auto tempFunc=dynamic_cast<Function*>(getSymbol(name).get())){
       if(tempFunc->defined||forward){
         yyerror("Function already defined\n");
       }
+      if(tempFunc->funcType!=func.funcType||tempFunc->typeList.size()!=func.typeList.size()
+        ||(func.funcType==Function::function&&!sameType(tempFunc->returnType, func.returnType))){
+        yyerror("Definition doesn't match forward declaration\n");
+      }
+      for(int i=0;i<func.typeList.size();++i){
+        if(tempFunc->typeList[i].first.size()!=func.typeList[i].first.size()||!sameType(tempFunc->typeList[i].second, func.typeList[i].second)
+          ||tempFunc->byRef(i)!=func.byRef(i)){
+          yyerror("Definition doesn't match forward declaration\n");
+        }
+      }
       tempFunc->defined=true;
     }
     else{
@@ -210,10 +376,19 @@ void SymbolTable::addFunction(std::string name, Function func, bool forward){
   tables.back().insert(std::make_pair(name, std::make_shared<Function>(func)));
 };
 
+//Imported procedures get their frames after every global, which is only known once the outer VAR section is done
+void SymbolTable::placeImports(){
+  std::for_each(imported.begin(), imported.end(),
+    [&](std::shared_ptr<Function> func){
+      func->offset=offset[1];
+    });
+  imported.clear();
+};
+
 bool SymbolTable::lookup(std::string name){
   bool returnVal=false;
   std::for_each(tables.begin(), tables.end(),
-    [&](std::map<std::string, std::shared_ptr<Symbol>> map){
+    [&](const std::map<std::string, std::shared_ptr<Symbol>> &map){
       returnVal=returnVal||(map.find(name)!=map.end());
     });
   return returnVal;
@@ -254,27 +429,44 @@ SymbolTable::SymbolTable():tables()
 ,labels(0)
 ,controlLabels(0)
 ,ifLabels(0)
+,condLabels(0)
+,boundsChecks(0)
+,boundsRemoved(0)
+,keptLines(0)
+,loopDepth(0)
+,spillsUsed(0)
+,spills(0)
+,frameEnd(0)
+,noSpill(false)
+,nextReg(0)
 ,controlStack()
 ,ifStack()
 ,stringConsts(){
   offset.resize(2);
   registers.resize(18);
   std::fill(registers.begin(), registers.end(), true);
+  kept.resize(18);
   std::map<std::string, std::shared_ptr<Symbol>> temp, mainScope;
-  temp.insert(std::make_pair("integer", std::make_shared<Simple>(Simple::integer, "integer")));
-  temp.insert(std::make_pair("INTEGER", std::make_shared<Simple>(Simple::integer, "INTEGER")));
-  temp.insert(std::make_pair("char", std::make_shared<Simple>(Simple::character, "char")));
-  temp.insert(std::make_pair("CHAR", std::make_shared<Simple>(Simple::character, "CHAR")));
-  temp.insert(std::make_pair("boolean", std::make_shared<Simple>(Simple::boolean, "boolean")));
-  temp.insert(std::make_pair("BOOLEAN", std::make_shared<Simple>(Simple::boolean, "BOOLEAN")));
-  temp.insert(std::make_pair("string", std::make_shared<Simple>(Simple::string, "string")));
-  temp.insert(std::make_pair("STRING", std::make_shared<Simple>(Simple::string, "STRING")));
+  auto integerType=internType(std::make_shared<Simple>(Simple::integer, "integer"));
+  auto charType=internType(std::make_shared<Simple>(Simple::character, "char"));
+  auto booleanType=internType(std::make_shared<Simple>(Simple::boolean, "boolean"));
+  auto stringType=internType(std::make_shared<Simple>(Simple::string, "string"));
+  temp.insert(std::make_pair("integer", integerType));
+  temp.insert(std::make_pair("INTEGER", integerType));
+  temp.insert(std::make_pair("char", charType));
+  temp.insert(std::make_pair("CHAR", charType));
+  temp.insert(std::make_pair("boolean", booleanType));
+  temp.insert(std::make_pair("BOOLEAN", booleanType));
+  temp.insert(std::make_pair("string", stringType));
+  temp.insert(std::make_pair("STRING", stringType));
   temp.insert(std::make_pair("true", std::make_shared<Const>(true, "true")));
   temp.insert(std::make_pair("TRUE", std::make_shared<Const>(true, "TRUE")));
   temp.insert(std::make_pair("false", std::make_shared<Const>(false, "false")));
   temp.insert(std::make_pair("FALSE", std::make_shared<Const>(false, "FALSE")));
   tables.push_back(temp);
   tables.push_back(mainScope);
+  funcStack.resize(2);
+  typeMarks.resize(2, types.size());
 };
 
 Const* negative(Const val){
@@ -284,6 +476,40 @@ Const* negative(Const val){
   return new Const(-val.numVal);
 }
 
+Const* chrOp(Const val){
+  if(!checkIdent(val, Const::intType)&&val.type!=Const::charType){
+    yyerror("Invalid operator on const expression");
+  }
+  return new Const((char)((val.type==Const::intType)?(val.numVal):(val.charVal)));
+}
+
+Const* ordOp(Const val){
+  if(!checkIdent(val, Const::charType)&&val.type!=Const::intType&&val.type!=Const::booleanType){
+    yyerror("Invalid operator on const expression");
+  }
+  switch(val.type){
+    case Const::charType: return new Const((int)val.charVal);
+    case Const::booleanType: return new Const((int)val.boolVal);
+    default: return new Const(val.numVal);
+  }
+}
+
+//SUCC and PRED keep the type of their argument
+Const* step(Const val, int delta){
+  checkIdent(val, Const::intType);
+  switch(val.type){
+    case Const::intType: return new Const(val.numVal+delta);
+    case Const::charType: return new Const((char)(val.charVal+delta));
+    case Const::booleanType:
+      if(val.boolVal+delta<0||val.boolVal+delta>1){
+        yyerror("PRED or SUCC of a boolean out of range\n");
+      }
+      return new Const((bool)(val.boolVal+delta));
+    default: yyerror("Invalid operator on const expression");
+  }
+  return nullptr;
+}
+
 Const* notOp(Const val){
   if(!checkIdent(val, Const::booleanType)){
     yyerror("Invalid operator on const expression");
@@ -292,35 +518,35 @@ Const* notOp(Const val){
 }
 
 Const* mod(Const left, Const right){
-  if((left.type!=Const::intType)||(!sameType(left, right))){
+  if((!sameType(left, right))||(left.type!=Const::intType)){
     yyerror("Invalid operator on const expression");
   }
   return new Const(left.numVal%right.numVal);  
 };
 
 Const* div(Const left, Const right){
-  if((left.type!=Const::intType)||(!sameType(left, right))){
+  if((!sameType(left, right))||(left.type!=Const::intType)){
     yyerror("Invalid operator on const expression");
   }
   return new Const(left.numVal/right.numVal);  
 };
 
 Const* mult(Const left, Const right){
-  if((left.type!=Const::intType)||(!sameType(left, right))){
+  if((!sameType(left, right))||(left.type!=Const::intType)){
     yyerror("Invalid operator on const expression");
   }
   return new Const(left.numVal*right.numVal);  
 };
 
 Const* sub(Const left, Const right){
-  if((left.type!=Const::intType)||(!sameType(left, right))){
+  if((!sameType(left, right))||(left.type!=Const::intType)){
     yyerror("Invalid operator on const expression");
   }
   return new Const(left.numVal-right.numVal);  
 };
 
 Const* add(Const left, Const right){
-  if((left.type!=Const::intType)||(!sameType(left, right))){
+  if((!sameType(left, right))||(left.type!=Const::intType)){
     yyerror("Invalid operator on const expression");
   }
   return new Const(left.numVal+right.numVal);  
@@ -422,10 +648,28 @@ bool sameType(Const &left, Const &right){
   return left.type==right.type;
 }
 
-bool checkIdent(Const &val, Const::ConstType type){
-  if(val.type==Const::identType){
-    val=*(dynamic_cast<Const*>(SymbolTable::getInstance()->getSymbol(val.name).get()));
+bool sameType(std::shared_ptr<Type> left, std::shared_ptr<Type> right){
+  return sameType(left.get(), right.get());
+}
+
+bool sameType(Type *left, Type *right){
+  return left->id==right->id;
+}
+
+//A constant written as the name of another one takes that one's value
+void resolveConst(Const &val){
+  if(val.type!=Const::identType){
+    return;
   }
+  auto target=dynamic_cast<Const*>(SymbolTable::getInstance()->getSymbol(val.name).get());
+  if(!target){
+    yyerror((val.name+" is not a constant\n").data());
+  }
+  val=*target;
+}
+
+bool checkIdent(Const &val, Const::ConstType type){
+  resolveConst(val);
   return val.type==type;
 }
 
@@ -440,96 +684,758 @@ int getSize(std::string val){
 Expression *getLval(std::vector<Expression> exprList){
   auto tempVar=dynamic_cast<Var*>(SymbolTable::getInstance()->getSymbol(exprList[0].getVal<std::string>()).get());
   if(!tempVar){
-    // auto tempConst=dynamic_cast<Const*>(SymbolTable::getInstance()->getSymbol(exprList[0].getVal<std::string>()).get());
-    // if(!tempConst){ 
+    //Named constants are read as literals so they fold like any other
+    auto tempConst=dynamic_cast<Const*>(SymbolTable::getInstance()->getSymbol(exprList[0].getVal<std::string>()).get());
+    if(!tempConst||exprList.size()>1){
       yyerror("Var cast failed\n");
-    // }
-    //TODO typechecking and get const vals
-
-  }
-  int rootLoc=tempVar->location;
-  int lastLower;
-  // auto lastType=dynamic_cast<Type*>(tempVar->type.get());
-  auto lastType=dynamic_cast<Type*>(SymbolTable::getInstance()->getSymbol(tempVar->type->name).get());
-  // if(lastType->typeType==Type::array){
-  //   lastLower=(dynamic_cast<Array*>(lastType))->lower;
-  //   lastType=dynamic_cast<Type*>(dynamic_cast<Array*>(lastType)->type.get());
-  // }
-  if(exprList.size()>1){
-    bool rootInt=true;
-    int locReg=SymbolTable::getInstance()->getReg();
-    int tempReg=SymbolTable::getInstance()->getReg(), tempRegMult=SymbolTable::getInstance()->getReg();
-    emit<<"move $"<<locReg<<", $zero"<<std::endl;
-    // std::for_each(exprList.begin()+1, exprList.end(),
-      // [&](Expression expr){
-    for(int i=1;i<exprList.size();++i){
-    if(lastType->typeType==Type::array){
-      lastLower=(dynamic_cast<Array*>(SymbolTable::getInstance()->getSymbol(lastType->name).get()))->lower;
-      lastType=dynamic_cast<Type*>(dynamic_cast<Array*>(SymbolTable::getInstance()->getSymbol(lastType->name).get())->type.get());
-    }
-        if(exprList[i].type==Expression::intType){
-          if(exprList[i].lit){
-            rootLoc+=((exprList[i].getVal<int>()-lastLower)*lastType->size);
-          }
-          else{
-            emit<<"lw $"<<tempReg<<", "<<exprList[i].getVal<int>()<<"($fp)"<<std::endl;
-            emit<<"addi $"<<tempReg<<", $"<<tempReg<<", "<<(-lastLower)<<std::endl;
-            emit<<"li $"<<tempRegMult<<", "<<lastType->size<<std::endl;
-            emit<<"mult $"<<tempReg<<", $"<<tempRegMult<<std::endl;
-            emit<<"mflo $"<<tempReg<<std::endl;
-            emit<<"add $"<<locReg<<", $"<<locReg<<", $"<<tempReg<<std::endl;
-          }
-        }
-        else if(exprList[i].type==Expression::stringType){
-          auto tempRec=(dynamic_cast<Record*>(lastType));
-          if(tempRec->layout.find(exprList[i].getVal<std::string>())==tempRec->layout.end()){
-            yyerror("Invalid lvalue expression");
-          }
-          auto mem=tempRec->layout.at(exprList[i].getVal<std::string>());
-          rootLoc+=mem.second;
-          lastType=dynamic_cast<Type*>(SymbolTable::getInstance()->getSymbol(mem.first->name).get());
+    }
+    auto value=*tempConst;
+    checkIdent(value, Const::identType);
+    switch(value.type){
+      case Const::intType: return new Expression(value.numVal, Expression::intType, true);
+      case Const::charType: return new Expression(value.charVal, Expression::charType, true);
+      case Const::booleanType: return new Expression(value.boolVal, Expression::boolType, true);
+      case Const::stringType: return new Expression(value.location, Expression::stringType, true);
+      default: yyerror("Var cast failed\n");
+    }
+  }
+  auto func=SymbolTable::getInstance()->funcStack.back();
+  if(func&&(tempVar->ref||!isLocal(tempVar))){
+    func->effects.readsGlobals=true;
+  }
+  //A VAR parameter is addressed from the pointer in its slot rather than from the frame
+  int rootLoc=((tempVar->ref)?(0):(tempVar->location));
+  auto lastType=tempVar->type.get();
+  Expression *index=nullptr;
+  for(int i=1;i<exprList.size();++i){
+    if(lastType->typeType==Type::array&&exprList[i].type!=Expression::stringType){
+      auto tempArr=dynamic_cast<Array*>(lastType);
+      lastType=tempArr->type.get();
+      if(exprList[i].lit){
+        if(boundsCheck){
+          boundsCheckIndex(&exprList[i], tempArr);
         }
-        else{
-          yyerror("Invalid lvalue expression");
+        rootLoc+=((exprList[i].getInt()-tempArr->lower)*lastType->size);
+      }
+      else{
+        if(boundsCheck){
+          boundsCheckIndex(&exprList[i], tempArr);
         }
-      // });
+        rootLoc-=tempArr->lower*lastType->size;
+        auto scaled=evalSpec(&exprList[i], new Expression(lastType->size, Expression::intType, true), "mult");
+        index=((index)?(eval(index, scaled, "add")):(scaled));
+        SymbolTable::getInstance()->unkeep(&exprList[i]);
       }
     }
-  auto simpTemp=(dynamic_cast<Simple*>(SymbolTable::getInstance()->getSymbol(lastType->name).get()));
-  if(!simpTemp){
-    auto what=dynamic_cast<Array*>(SymbolTable::getInstance()->getSymbol(lastType->name).get());
-    simpTemp=(dynamic_cast<Simple*>(SymbolTable::getInstance()->getSymbol(what->type->name).get()));
+    else if(lastType->typeType==Type::record&&exprList[i].type==Expression::stringType&&!exprList[i].lit){
+      auto tempRec=(dynamic_cast<Record*>(lastType));
+      if(tempRec->layout.find(exprList[i].getVal<std::string>())==tempRec->layout.end()){
+        yyerror("Invalid lvalue expression");
+      }
+      auto mem=tempRec->layout.at(exprList[i].getVal<std::string>());
+      rootLoc+=mem.second;
+      lastType=mem.first.get();
+    }
+    else{
+      yyerror("Invalid lvalue expression");
+    }
   }
-  return new Expression(rootLoc, Expression::intType, false, (simpTemp->simType==Simple::character||simpTemp->simType==Simple::string), true);
+  auto simpTemp=dynamic_cast<Simple*>(lastType);
+  if(!simpTemp&&lastType->typeType==Type::array){
+    simpTemp=dynamic_cast<Simple*>(dynamic_cast<Array*>(lastType)->type.get());
+  }
+  auto lval=new Expression(rootLoc, Expression::intType, false, (simpTemp&&(simpTemp->simType==Simple::character||simpTemp->simType==Simple::string)), true);
+  lval->size=lastType->size;
+  lval->root=tempVar;
+  lval->varType=lastType;
+  lval->boolean=(simpTemp&&simpTemp->simType==Simple::boolean&&lastType->typeType!=Type::array);
+  std::string base="fp";
+  std::string baseKey;
+  if(tempVar->ref){
+    auto slot=new Expression(tempVar->location, Expression::intType);
+    base=std::to_string(loadExpr(slot));
+    baseKey="+"+valueKey(slot);
+    if(!index){
+      lval->addrReg=std::stoi(base);
+    }
+  }
+  if(index){
+    auto key="&("+valueKey(index)+baseKey+")";
+    lval->addrReg=SymbolTable::getInstance()->getValue(key);
+    if(lval->addrReg<0){
+      int indexReg=loadExpr(index);
+      SymbolTable::getInstance()->release(index, indexReg);
+      lval->addrReg=SymbolTable::getInstance()->getReg();
+      emit<<"add $"<<lval->addrReg<<", $"<<indexReg<<", $"<<base<<std::endl;
+      SymbolTable::getInstance()->setValue(key, lval->addrReg);
+    }
+  }
+  return lval;
 }
 
 int SymbolTable::getReg(){
-  for(int i=0;i<registers.size();++i){
+  int reg=-1;
+  //Registers are handed out round robin so a freed one isn't reused straight away, which would tie
+  //otherwise independent instructions together for the scheduler
+  for(int j=0;j<registers.size()&&reg<0;++j){
+    int i=(nextReg+j)%registers.size();
+    if(registers[i]&&std::none_of(values.begin(), values.end(),
+      [&](std::pair<std::string, int> val){
+        return val.second==i+8;
+      })){
+      reg=i+8;
+    }
+  }
+  for(int i=0;i<registers.size()&&reg<0;++i){
     if(registers[i]){
-      registers[i]=false;
-      return i+8;
+      reg=i+8;
+    }
+  }
+  if(reg<0){
+    spill();
+    for(int i=0;i<registers.size()&&reg<0;++i){
+      if(registers[i]){
+        reg=i+8;
+      }
     }
   }
-  yyerror("Out of registers\n");
+  if(reg<0){
+    yyerror("Out of registers\n");
+  }
+  registers[reg-8]=false;
+  nextReg=(reg-7)%registers.size();
+  for(auto it=values.begin();it!=values.end();){
+    it=((it->second==reg)?(values.erase(it)):(std::next(it)));
+  }
+  killValues("$"+std::to_string(reg));
+  return reg;
 }
 
 void SymbolTable::clearReg(){
   std::fill(registers.begin(), registers.end(), true);
+  std::fill(kept.begin(), kept.end(), 0);
+  nextReg=0;
+  temps.clear();
+  locked.clear();
+  spillsUsed=0;
+  lastCall.reset();
+  lastCompare.reset();
+  jumpSites.clear();
+}
+
+//Values already sitting in registers, keyed by how they were computed. Registers holding a value
+//stay cached after clearReg and are only handed out again once the uncached ones run out.
+int SymbolTable::getValue(std::string key){
+  if(values.find(key)==values.end()){
+    return -1;
+  }
+  int reg=values.at(key);
+  registers[reg-8]=false;
+  return reg;
+}
+
+void SymbolTable::setValue(std::string key, int reg){
+  values[key]=reg;
+}
+
+//Drops every value computed from token
+void SymbolTable::killValues(std::string token){
+  for(auto it=values.begin();it!=values.end();){
+    bool found=false;
+    for(auto pos=it->first.find(token);pos!=std::string::npos&&!found;pos=it->first.find(token, pos+1)){
+      found=(pos+token.size()==it->first.size()||!isalnum(it->first[pos+token.size()]));
+    }
+    it=((found)?(values.erase(it)):(std::next(it)));
+  }
+}
+
+//Drops loads through computed addresses, or every value read from memory
+void SymbolTable::killMemory(bool all){
+  for(auto it=values.begin();it!=values.end();){
+    bool found=(it->first.find('*')!=std::string::npos)||(all&&it->first.find('@')!=std::string::npos);
+    it=((found)?(values.erase(it)):(std::next(it)));
+  }
+}
+
+void SymbolTable::clearValues(){
+  values.clear();
+}
+
+//Results waiting to be used are tracked so their registers can be freed once they are, or spilled when
+//the registers run out
+Expression *SymbolTable::tempExpr(int reg){
+  auto temp=new Expression(reg, Expression::reg);
+  temps.push_back(temp);
+  return temp;
+}
+
+//For results copied into argument and index lists, which can't be rewritten if they're spilled
+void SymbolTable::keepTemp(Expression *expr){
+  if(expr->type!=Expression::reg){
+    return;
+  }
+  auto it=std::find(temps.begin(), temps.end(), expr);
+  if(it!=temps.end()){
+    temps.erase(it);
+  }
+  ++kept[expr->getVal<int>()-8];
+}
+
+void SymbolTable::unkeep(Expression *expr){
+  if(expr->type!=Expression::reg||kept[expr->getVal<int>()-8]==0){
+    return;
+  }
+  --kept[expr->getVal<int>()-8];
+  freeIfDead(expr->getVal<int>());
+}
+
+//An operand has been used, so its register is free unless something else still needs it
+void SymbolTable::release(Expression *expr, int reg){
+  if(expr->type==Expression::reg){
+    auto it=std::find(temps.begin(), temps.end(), expr);
+    if(it!=temps.end()){
+      temps.erase(it);
+    }
+    reg=expr->getVal<int>();
+  }
+  if(reg>=0){
+    freeIfDead(reg);
+  }
+}
+
+void SymbolTable::freeIfDead(int reg){
+  if(reg<8||reg>25||kept[reg-8]>0||std::find(locked.begin(), locked.end(), reg)!=locked.end()){
+    return;
+  }
+  if(std::any_of(temps.begin(), temps.end(),
+    [&](Expression *expr){
+      return expr->getVal<int>()==reg;
+    })){
+    return;
+  }
+  registers[reg-8]=true;
+}
+
+//Procedures keep their slots as variables so calls save them with the rest of the frame. The main
+//program's go past every procedure frame.
+int SymbolTable::spillSlot(){
+  if(spillsUsed==spillSlots.size()){
+    if(funcStack.back()){
+      auto name="$spill"+std::to_string(spillSlots.size());
+      addSymbol(name, Var(std::dynamic_pointer_cast<Type>(tables[0].at("integer")), offset.back(), name));
+    }
+    else{
+      offset.back()=std::max(offset.back(), frameEnd);
+    }
+    spillSlots.push_back(offset.back());
+    offset.back()+=4;
+  }
+  return spillSlots[spillsUsed++];
+}
+
+//Stores the oldest waiting result, which is the one used last, and turns it into a memory operand
+bool SymbolTable::spill(){
+  if(noSpill){
+    return false;
+  }
+  auto victim=std::find_if(temps.begin(), temps.end(),
+    [&](Expression *expr){
+      int reg=expr->getVal<int>();
+      return kept[reg-8]==0&&std::find(locked.begin(), locked.end(), reg)==locked.end();
+    });
+  if(victim==temps.end()){
+    return false;
+  }
+  int reg=(*victim)->getVal<int>();
+  int slot=spillSlot();
+  emit<<"sw $"<<reg<<", "<<slot<<"($fp)"<<std::endl;
+  for(auto it=temps.begin();it!=temps.end();){
+    if((*it)->getVal<int>()!=reg){
+      ++it;
+      continue;
+    }
+    (*it)->type=Expression::intType;
+    (*it)->val=std::make_shared<int>(slot);
+    (*it)->site.reset();
+    it=temps.erase(it);
+  }
+  registers[reg-8]=true;
+  ++spills;
+  return true;
+}
+
+std::shared_ptr<AllocState> SymbolTable::saveState(){
+  auto state=std::make_shared<AllocState>();
+  state->registers=registers;
+  state->values=values;
+  state->temps=temps;
+  state->spills=spills;
+  return state;
+}
+
+void SymbolTable::restoreState(std::shared_ptr<AllocState> state){
+  registers=state->registers;
+  values=state->values;
+  temps=state->temps;
 }
 
 // void SymbolTable::lockReg(int reg){
 //   registers[reg-8]=false;
 // }
 
+std::string baseReg(Expression *expr){
+  return ((expr->addrReg<0)?(std::string("fp")):(std::to_string(expr->addrReg)));
+}
+
+std::string address(Expression *expr){
+  return std::to_string(expr->getVal<int>())+"($"+baseReg(expr)+")";
+}
+
+std::string valueKey(Expression *expr){
+  if(expr->type==Expression::reg){
+    for(auto it=SymbolTable::getInstance()->values.begin();it!=SymbolTable::getInstance()->values.end();++it){
+      if(it->second==expr->getVal<int>()){
+        return it->first;
+      }
+    }
+    return "$"+std::to_string(expr->getVal<int>());
+  }
+  if(expr->lit){
+    return "#"+std::to_string(expr->getInt());
+  }
+  if(expr->addrReg<0){
+    return "@"+std::to_string(expr->getVal<int>());
+  }
+  return "*"+std::to_string(expr->getVal<int>())+"["+valueKey(new Expression(expr->addrReg, Expression::reg))+"]";
+}
+
+int loadExpr(Expression *expr){
+  if(expr->type==Expression::reg){
+    return expr->getVal<int>();
+  }
+  auto key=valueKey(expr);
+  int reg=SymbolTable::getInstance()->getValue(key);
+  if(reg>=0){
+    return reg;
+  }
+  reg=SymbolTable::getInstance()->getReg();
+  if(expr->lit){
+    emit<<"li $"<<reg<<", "<<expr->getInt()<<std::endl;
+  }
+  else{
+    emit<<"lw $"<<reg<<", "<<address(expr)<<std::endl;
+  }
+  SymbolTable::getInstance()->setValue(key, reg);
+  return reg;
+}
+
+//A store kills whatever may have been read from that location and leaves reg holding its new value
+void storeValue(Expression *lval, int reg){
+  auto key=valueKey(lval);
+  if(lval->addrReg<0){
+    SymbolTable::getInstance()->killValues(key);
+    SymbolTable::getInstance()->killMemory(false);
+  }
+  else{
+    SymbolTable::getInstance()->killMemory(true);
+  }
+  if(reg>=0){
+    SymbolTable::getInstance()->setValue(key, reg);
+  }
+}
+
+//The values an index can take, when it's a constant, a FOR variable over constant bounds, or one of those
+//moved by a constant
+bool indexRange(Expression *expr, int &low, int &high, LoopRange *&loop){
+  if(expr->lit){
+    low=high=expr->getInt();
+    return true;
+  }
+  if(expr->site){
+    auto site=expr->site;
+    auto operand=site->left;
+    int delta;
+    if(site->op=="succ"||site->op=="pred"){
+      delta=((site->op=="succ")?(1):(-1));
+    }
+    else if(site->op=="add"&&site->right->lit){
+      delta=site->right->getInt();
+    }
+    else if(site->op=="add"&&site->left->lit){
+      delta=site->left->getInt();
+      operand=site->right;
+    }
+    else if(site->op=="sub"&&site->right->lit){
+      delta=-site->right->getInt();
+    }
+    else{
+      return false;
+    }
+    if(!indexRange(operand, low, high, loop)){
+      return false;
+    }
+    low+=delta;
+    high+=delta;
+    return true;
+  }
+  if(expr->type!=Expression::intType||expr->addrReg>=0||!expr->root||expr->root->ref||expr->getVal<int>()!=expr->root->location){
+    return false;
+  }
+  auto &ranges=SymbolTable::getInstance()->loopRanges;
+  for(int i=ranges.size()-1;i>=0;--i){
+    if(ranges[i].var==expr->root){
+      low=ranges[i].low;
+      high=ranges[i].high;
+      loop=&ranges[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+//One unsigned compare covers both bounds. Constant indices are settled here, and checks on FOR
+//variables are handed to the loop to be removed if the variable is never written.
+void boundsCheckIndex(Expression *expr, Array *arr){
+  auto table=SymbolTable::getInstance();
+  int label=table->boundsChecks++;
+  int low, high;
+  LoopRange *loop=nullptr;
+  bool known=indexRange(expr, low, high, loop);
+  bool safe=known&&low>=arr->lower&&high<=arr->upper;
+  if(expr->lit){
+    if(!safe){
+      yyerror("Array index out of bounds\n");
+    }
+    ++table->boundsRemoved;
+    return;
+  }
+  int reg=loadExpr(expr);
+  table->locked.push_back(reg);
+  int test=table->getReg();
+  table->locked.pop_back();
+  std::stringstream check;
+  if(arr->lower!=0){
+    check<<"addi $"<<test<<", $"<<reg<<", "<<-arr->lower<<std::endl;
+    check<<"sltiu $"<<test<<", $"<<test<<", "<<arr->upper-arr->lower+1<<std::endl;
+  }
+  else{
+    check<<"sltiu $"<<test<<", $"<<reg<<", "<<arr->upper+1<<std::endl;
+  }
+  check<<"beq $"<<test<<", $zero, __bounds"<<label<<std::endl;
+  if(safe&&loop){
+    loop->checks.push_back(std::make_pair(emit.tellp(), check.str()));
+  }
+  emit<<check.str();
+  table->freeIfDead(test);
+  table->boundsTraps[label]=std::make_pair(lineNum, reg);
+}
+
+//Anything that stores to a FOR variable inside its loop keeps the loop's checks. Stores outside the
+//procedure's own frame are an effect of the procedure.
+void noteWrite(Var *var){
+  var->written=true;
+  auto func=SymbolTable::getInstance()->funcStack.back();
+  if(func&&(var->ref||!isLocal(var))){
+    func->effects.writesMemory=true;
+  }
+  std::for_each(SymbolTable::getInstance()->loopRanges.begin(), SymbolTable::getInstance()->loopRanges.end(),
+    [&](LoopRange &range){
+      if(range.var==var){
+        range.written=true;
+      }
+    });
+}
+
+void noteIO(){
+  if(auto func=SymbolTable::getInstance()->funcStack.back()){
+    func->effects.io=true;
+  }
+}
+
+bool isLocal(Var *var){
+  auto &scope=SymbolTable::getInstance()->tables.back();
+  return std::any_of(scope.begin(), scope.end(),
+    [&](std::pair<std::string, std::shared_ptr<Symbol>> sym){
+      return sym.second.get()==var;
+    });
+}
+
+void forRangeBegin(Expression *var, Expression *start){
+  bool plain=var->root&&!var->root->ref&&var->size==4&&var->getVal<int>()==var->root->location;
+  SymbolTable::getInstance()->loopRanges.push_back(LoopRange(((plain&&start->lit)?(var->root):(nullptr)), ((start->lit)?(start->getInt()):(0)), 0));
+  SymbolTable::getInstance()->loopRanges.back().top=emit.tellp();
+}
+
+void forRangeLimit(Expression *limit, bool down){
+  auto &range=SymbolTable::getInstance()->loopRanges.back();
+  range.body=emit.tellp();
+  range.down=down;
+  if(!limit->lit){
+    range.var=nullptr;
+    return;
+  }
+  range.high=limit->getInt();
+  if(down){
+    std::swap(range.low, range.high);
+  }
+}
+
+//Once the body is known not to write the variable, constant bounds give the trip count. The checks are
+//blanked in place so the positions other sites hold in emit stay valid. A check that was rewound over or
+//moved no longer matches its text and is left alone.
+void forRangeEnd(){
+  auto table=SymbolTable::getInstance();
+  auto &range=table->loopRanges.back();
+  if(range.written){
+    return;
+  }
+  if(range.var){
+    range.trips=std::max(range.high-range.low+1, 0);
+  }
+  auto end=emit.tellp();
+  auto code=emit.str();
+  std::for_each(range.checks.begin(), range.checks.end(),
+    [&](std::pair<std::streampos, std::string> check){
+      if(check.first+(std::streamoff)check.second.size()>end||code.compare(check.first, check.second.size(), check.second)!=0){
+        return;
+      }
+      auto blank=check.second;
+      std::replace_if(blank.begin(), blank.end(),
+        [&](char c){
+          return c!='\n';
+        }, ' ');
+      emit.seekp(check.first);
+      emit<<blank;
+      if(table->boundsTraps.erase(std::stoi(check.second.substr(check.second.rfind("__bounds")+8)))){
+        ++table->boundsRemoved;
+      }
+    });
+  emit.seekp(end);
+}
+
+//Rewrites a FOR loop with a constant trip count once its end has been emitted. A loop that fits in the
+//unroll budget becomes a copy of the check and body per iteration with the variable's value built in. A
+//larger one runs several copies for each check, and the iterations left over are peeled off in front so
+//the check stays exact.
+void forUnroll(){
+  auto table=SymbolTable::getInstance();
+  auto range=table->loopRanges.back();
+  table->loopRanges.pop_back();
+  if(range.trips<0||unrollBudget<=0){
+    return;
+  }
+  auto end=emit.tellp();
+  auto text=emit.str().substr(range.top, end-range.top);
+  auto colon=text.find(": ");
+  auto top=text.substr(0, colon);
+  auto after="__controlStmtAfter"+top.substr(13);
+  auto tail="j "+top+"\n"+after+": \n";
+  std::streamoff bodyStart=range.body-range.top;
+  if(top.substr(0, 13)!="__controlStmt"||bodyStart<=colon+2||text.size()<bodyStart+tail.size()
+    ||text.compare(text.size()-tail.size(), tail.size(), tail)!=0){
+    return;
+  }
+  auto check=text.substr(colon+2, bodyStart-colon-2);
+  auto branch=check.rfind('\n', check.size()-2);
+  branch=((branch==std::string::npos)?(0):(branch+1));
+  if(check.size()<=after.size()+1||check.compare(check.size()-after.size()-1, after.size()+1, after+"\n")!=0){
+    return;
+  }
+  auto body=text.substr(bodyStart, text.size()-tail.size()-bodyStart);
+  auto iteration=check.substr(0, branch)+body;
+  int size=0, copies=0;
+  std::stringstream lines(iteration);
+  std::string line;
+  while(std::getline(lines, line)){
+    size+=(line.find_first_not_of(" \t")!=std::string::npos);
+  }
+  auto copy=[&](std::map<int, int> consts){
+    return specialize(iteration, "", "___"+top.substr(13)+"_"+std::to_string(copies++)+"_", consts);
+  };
+  auto value=[&](int trip){
+    return std::map<int, int>{{range.var->location, ((range.down)?(range.high-trip):(range.low+trip))}};
+  };
+  std::string code;
+  if((long long)range.trips*size<=unrollBudget){
+    for(int i=0;i<range.trips;++i){
+      code+=copy(value(i));
+    }
+    code+=after+": \n";
+  }
+  else{
+    int factor=8;
+    while(factor>1&&(factor+range.trips%factor)*size>unrollBudget){
+      --factor;
+    }
+    if(factor<2){
+      return;
+    }
+    int peeled=range.trips%factor;
+    for(int i=0;i<peeled;++i){
+      code+=copy(value(i));
+    }
+    code+=top+": "+check+body;
+    for(int i=1;i<factor;++i){
+      code+=copy(std::map<int, int>());
+    }
+    code+=tail;
+  }
+  emit.seekp(range.top);
+  emit<<code;
+  table->clearValues();
+  //Checks the enclosing loops may still remove now sit wherever the copies put them
+  std::for_each(table->loopRanges.begin(), table->loopRanges.end(),
+    [&](LoopRange &outer){
+      std::vector<std::pair<std::streampos, std::string>> checks;
+      std::for_each(outer.checks.begin(), outer.checks.end(),
+        [&](std::pair<std::streampos, std::string> check){
+          if(check.first<range.top){
+            checks.push_back(check);
+            return;
+          }
+          for(auto pos=code.find(check.second);pos!=std::string::npos;pos=code.find(check.second, pos+1)){
+            checks.push_back(std::make_pair(range.top+(std::streamoff)pos, check.second));
+          }
+        });
+      outer.checks=checks;
+    });
+}
+
 void evalBoilerPlate(int &leftReg, int &rightReg, Expression *left, Expression* right){
-  leftReg=((left->type==Expression::reg)?(left->getVal<int>()):(SymbolTable::getInstance()->getReg()));
-  rightReg=((right->type==Expression::reg)?(right->getVal<int>()):(SymbolTable::getInstance()->getReg()));
-  if(left->type!=Expression::reg){
-    emit<<((left->lit)?("li $"+std::to_string(leftReg)+", "+std::to_string(left->getVal<int>())):("lw $")+std::to_string(leftReg)+", "+std::to_string(left->getVal<int>())+"($fp)")<<std::endl;
+  leftReg=loadExpr(left);
+  SymbolTable::getInstance()->locked.push_back(leftReg);
+  rightReg=loadExpr(right);
+  SymbolTable::getInstance()->locked.pop_back();
+}
+
+//Sethi-Ullman numbers. Operands sit in memory until the operation that uses them, so a leaf needs one register.
+int regNeed(Expression *expr){
+  return ((expr->site)?(expr->site->need):(1));
+}
+
+//A subtree stays pure while it's made of operations on plain variables and constants whose code is
+//contiguous. Its start and allocator state are those of whichever operand's code came first.
+std::shared_ptr<EvalSite> beginSite(Expression *left, Expression *right, std::string op){
+  auto site=std::make_shared<EvalSite>(op, left, right);
+  auto entry=emit.tellp();
+  std::vector<Expression*> operands={left};
+  if(right){
+    operands.push_back(right);
+  }
+  std::vector<std::shared_ptr<EvalSite>> sites;
+  std::for_each(operands.begin(), operands.end(),
+    [&](Expression *expr){
+      if(expr->site){
+        site->pure=site->pure&&expr->site->pure;
+        sites.push_back(expr->site);
+      }
+      else if(expr->type==Expression::reg||expr->addrReg>=0){
+        site->pure=false;
+      }
+    });
+  if(sites.size()==2&&sites[1]->end==sites[0]->start){
+    std::swap(sites[0], sites[1]);
+  }
+  for(int i=0;i<sites.size();++i){
+    if(sites[i]->end!=((i+1<sites.size())?(sites[i+1]->start):(entry))){
+      site->pure=false;
+    }
+  }
+  int leftNeed=regNeed(left);
+  int rightNeed=((right)?(regNeed(right)):(0));
+  site->need=((leftNeed==rightNeed)?(leftNeed+1):(std::max(leftNeed, rightNeed)));
+  if(site->pure){
+    site->start=((sites.empty())?(entry):(sites[0]->start));
+    site->state=((sites.empty())?(SymbolTable::getInstance()->saveState()):(sites[0]->state));
+  }
+  return site;
+}
+
+Expression *endSite(Expression *result, std::shared_ptr<EvalSite> site){
+  site->end=emit.tellp();
+  result->site=site;
+  return result;
+}
+
+Expression *regen(Expression *expr){
+  if(!expr->site){
+    return expr;
+  }
+  auto site=expr->site;
+  if(!site->right){
+    return ((site->op=="succ"||site->op=="pred")?(intrinsic(regen(site->left), site->op)):(evalUnary(regen(site->left), site->op)));
+  }
+  Expression *left, *right;
+  if(regNeed(site->right)>regNeed(site->left)){
+    right=regen(site->right);
+    left=regen(site->left);
+  }
+  else{
+    left=regen(site->left);
+    right=regen(site->right);
+  }
+  return ((site->op=="mult"||site->op=="div"||site->op=="mod")?(evalSpec(left, right, site->op)):(eval(left, right, site->op)));
+}
+
+//The parser emits the left operand first, so its result would be held in a register for all of the right.
+//When the right needs more registers, both are thrown away and regenerated the other way around.
+Expression *reorder(Expression *left, Expression *right, std::string op){
+  if(!left->site||!right->site||!left->site->pure||!right->site->pure||regNeed(right)<=regNeed(left)){
+    return nullptr;
+  }
+  if(left->site->end!=right->site->start||right->site->end!=emit.tellp()||left->site->state->spills!=SymbolTable::getInstance()->spills){
+    return nullptr;
   }
-  if(right->type!=Expression::reg){
-    emit<<((right->lit)?("li $"+std::to_string(rightReg)+", "+std::to_string(right->getVal<int>())):("lw $")+std::to_string(rightReg)+", "+std::to_string(right->getVal<int>())+"($fp)")<<std::endl;
+  emit.seekp(left->site->start);
+  SymbolTable::getInstance()->restoreState(left->site->state);
+  auto newRight=regen(right);
+  auto newLeft=regen(left);
+  return ((op=="mult"||op=="div"||op=="mod")?(evalSpec(newLeft, newRight, op)):(eval(newLeft, newRight, op)));
+}
+
+//The immediate instructions computing op against a constant, each applied to the result of the one
+//before. Comparisons become slti tests, inverted with xori where needed, and equality is tested on the
+//xor. sgt is left to the register form, which is a single slt with the operands swapped. Empty when the
+//constant doesn't fit the 16 bit fields and the register form is needed.
+std::vector<std::pair<std::string, int>> immediateOps(std::string op, long long val, bool swapped){
+  auto fits=[](long long val){
+    return val>=-32768&&val<=32767;
+  };
+  auto fitsUnsigned=[](long long val){
+    return val>=0&&val<=65535;
+  };
+  if(swapped){
+    static const std::map<std::string, std::string> mirror={{"add", "add"}, {"and", "and"}, {"or", "or"},
+      {"seq", "seq"}, {"sne", "sne"}, {"slt", "sgt"}, {"sgt", "slt"}, {"sle", "sge"}, {"sge", "sle"}};
+    if(mirror.find(op)==mirror.end()){
+      return {};
+    }
+    op=mirror.at(op);
+  }
+  if(op=="add"&&fits(val)){
+    return {{"addi", val}};
+  }
+  if(op=="sub"&&fits(-val)){
+    return {{"addi", -val}};
+  }
+  if((op=="and"||op=="or")&&fitsUnsigned(val)){
+    return {{op+"i", val}};
   }
+  if((op=="slt"||op=="sge")&&fits(val)){
+    return ((op=="slt")?(std::vector<std::pair<std::string, int>>{{"slti", val}}):(std::vector<std::pair<std::string, int>>{{"slti", val}, {"xori", 1}}));
+  }
+  if(op=="sle"&&fits(val+1)){
+    return {{"slti", val+1}};
+  }
+  if((op=="seq"||op=="sne")&&fitsUnsigned(val)){
+    std::vector<std::pair<std::string, int>> ops;
+    if(val!=0){
+      ops.push_back(std::make_pair("xori", val));
+    }
+    ops.push_back(((op=="seq")?(std::make_pair("sltiu", 1)):(std::make_pair("sltu", 0))));
+    return ops;
+  }
+  return {};
 }
 
 Expression *eval(Expression *left, Expression *right, std::string op)
@@ -537,35 +1443,360 @@ Expression *eval(Expression *left, Expression *right, std::string op)
   if(left->lit&&right->lit){
     return foldExpr(left, right, op);
   }
-  int leftReg, rightReg;
-  int dest=SymbolTable::getInstance()->getReg();
-  evalBoilerPlate(leftReg, rightReg, left, right);
-  emit<<op<<" $"<<dest<<", $"<<leftReg<<", $"<<rightReg<<std::endl;
-  return new Expression(dest, Expression::reg);
+  if(auto reordered=reorder(left, right, op)){
+    return reordered;
+  }
+  auto site=beginSite(left, right, op);
+  auto leftKey=valueKey(left), rightKey=valueKey(right);
+  if((op=="add"||op=="and"||op=="or"||op=="seq"||op=="sne")&&rightKey<leftKey){
+    std::swap(leftKey, rightKey);
+  }
+  auto key=op+"("+leftKey+","+rightKey+")";
+  auto start=emit.tellp();
+  int dest=SymbolTable::getInstance()->getValue(key);
+  auto lit=((right->lit&&right->type!=Expression::stringType)?(right):((left->lit&&left->type!=Expression::stringType)?(left):(nullptr)));
+  auto ops=((lit&&dest<0)?(immediateOps(op, lit->getInt(), lit==left)):(std::vector<std::pair<std::string, int>>()));
+  if(!ops.empty()){
+    auto var=((lit==left)?(right):(left));
+    int reg=loadExpr(var);
+    SymbolTable::getInstance()->release(var, reg);
+    SymbolTable::getInstance()->release(lit, -1);
+    dest=SymbolTable::getInstance()->getReg();
+    std::for_each(ops.begin(), ops.end(),
+      [&](std::pair<std::string, int> instr){
+        if(instr.first=="sltu"){
+          emit<<"sltu $"<<dest<<", $zero, $"<<reg<<std::endl;
+        }
+        else{
+          emit<<instr.first<<" $"<<dest<<", $"<<reg<<", "<<instr.second<<std::endl;
+        }
+        reg=dest;
+      });
+    SymbolTable::getInstance()->setValue(key, dest);
+  }
+  else if(dest<0){
+    int leftReg, rightReg;
+    evalBoilerPlate(leftReg, rightReg, left, right);
+    SymbolTable::getInstance()->release(left, leftReg);
+    SymbolTable::getInstance()->release(right, rightReg);
+    dest=SymbolTable::getInstance()->getReg();
+    emit<<op<<" $"<<dest<<", $"<<leftReg<<", $"<<rightReg<<std::endl;
+    SymbolTable::getInstance()->setValue(key, dest);
+  }
+  else{
+    SymbolTable::getInstance()->release(left, -1);
+    SymbolTable::getInstance()->release(right, -1);
+  }
+  auto result=endSite(SymbolTable::getInstance()->tempExpr(dest), site);
+  result->boolean=(op=="seq"||op=="sne"||op=="slt"||op=="sgt"||op=="sle"||op=="sge"||((op=="and"||op=="or")&&left->isBoolean()&&right->isBoolean()));
+  if(op=="seq"&&left->lit!=right->lit){
+    auto var=((left->lit)?(right):(left));
+    auto val=((left->lit)?(left):(right));
+    if(var->type!=Expression::reg&&var->addrReg<0&&val->type!=Expression::stringType){
+      SymbolTable::getInstance()->lastCompare=std::make_shared<CompareSite>(result, *var, val->getInt(), start, emit.tellp());
+    }
+  }
+  return result;
 } 
 
 Expression *evalSpec(Expression *left, Expression *right, std::string op){
   if(left->lit&&right->lit){
     return foldExpr(left, right, op);
   }
-  int leftReg, rightReg;
-  evalBoilerPlate(leftReg, rightReg, left, right);
-  emit<<((op=="mod"||op=="div")?("div "):("mult "))<<"$"<<leftReg<<", $"<<rightReg<<std::endl;
-  emit<<((op=="mod")?("mfhi "):("mflo "))<<"$"<<leftReg<<std::endl;//TODO dest?
-  return new Expression(leftReg, Expression::reg);
+  if(auto reordered=reorder(left, right, op)){
+    return reordered;
+  }
+  auto table=SymbolTable::getInstance();
+  auto site=beginSite(left, right, op);
+  auto leftKey=valueKey(left), rightKey=valueKey(right);
+  if(op=="mult"&&rightKey<leftKey){
+    std::swap(leftKey, rightKey);
+  }
+  auto key=op+"("+leftKey+","+rightKey+")";
+  int dest=table->getValue(key);
+  if(dest>=0){
+    table->release(left, -1);
+    table->release(right, -1);
+    return endSite(table->tempExpr(dest), site);
+  }
+  auto constant=((right->lit&&right->type==Expression::intType&&right->getInt()!=0)?(right):(nullptr));
+  auto other=left;
+  if(!constant&&left->lit&&left->type==Expression::intType&&op=="mult"){
+    constant=left;
+    other=right;
+  }
+  if(constant){
+    int reg=loadExpr(other);
+    table->locked.push_back(reg);
+    auto before=table->registers;
+    dest=((op=="mult")?(multConst(reg, constant->getInt())):(divConst(reg, constant->getInt(), op=="mod")));
+    table->locked.pop_back();
+    if(dest>=0){
+      //Intermediate results of the sequence are dead
+      for(int i=0;i<before.size();++i){
+        if(before[i]&&!table->registers[i]&&i+8!=dest){
+          table->freeIfDead(i+8);
+        }
+      }
+      table->release(other, reg);
+    }
+  }
+  if(dest<0){
+    int leftReg, rightReg;
+    evalBoilerPlate(leftReg, rightReg, left, right);
+    table->release(left, leftReg);
+    table->release(right, rightReg);
+    dest=table->getReg();
+    emit<<((op=="mod"||op=="div")?("div "):("mult "))<<"$"<<leftReg<<", $"<<rightReg<<std::endl;
+    emit<<((op=="mod")?("mfhi "):("mflo "))<<"$"<<dest<<std::endl;
+  }
+  table->setValue(key, dest);
+  return endSite(table->tempExpr(dest), site);
+}
+
+//Multiplies by a constant with shifts and adds when its signed digit form has at most three nonzero digits.
+//Returns the register holding the product, or -1 without emitting anything if mult is the better choice.
+int multConst(int reg, int val){
+  if(val==0||val==INT_MIN){
+    return -1;
+  }
+  std::vector<std::pair<int, int>> terms;
+  long long rest=std::abs((long long)val);
+  for(int pos=0;rest!=0;++pos, rest/=2){
+    if(rest%2!=0){
+      int digit=((rest%4==3)?(-1):(1));
+      terms.push_back(std::make_pair(pos, ((val<0)?(-digit):(digit))));
+      rest-=digit;
+    }
+  }
+  if(terms.size()>3){
+    return -1;
+  }
+  //Start from a positive term if there is one so no negation is needed
+  std::stable_sort(terms.begin(), terms.end(),
+    [&](const std::pair<int, int> &left, const std::pair<int, int> &right){
+      return left.second>right.second;
+    });
+  int acc=-1;
+  std::for_each(terms.begin(), terms.end(),
+    [&](std::pair<int, int> term){
+      int temp=reg;
+      if(term.first>0){
+        temp=SymbolTable::getInstance()->getReg();
+        emit<<"sll $"<<temp<<", $"<<reg<<", "<<term.first<<std::endl;
+      }
+      if(acc<0&&term.second>0){
+        acc=temp;
+        return;
+      }
+      int dest=SymbolTable::getInstance()->getReg();
+      emit<<((term.second>0)?("addu $"):("subu $"))<<dest<<", $"<<((acc<0)?(std::string("zero")):(std::to_string(acc)))<<", $"<<temp<<std::endl;
+      acc=dest;
+    });
+  if(acc==reg){
+    acc=SymbolTable::getInstance()->getReg();
+    emit<<"move $"<<acc<<", $"<<reg<<std::endl;
+  }
+  return acc;
+}
+
+//Signed division and remainder by a nonzero constant, truncating toward zero like div.
+//Powers of two shift with a bias of 2^k-1 for negative dividends, other divisors multiply by a magic
+//number and keep the high word (Hacker's Delight 10-1). The remainder is x-(x/|d|)*|d|.
+int divConst(int reg, int val, bool mod){
+  if(val==INT_MIN){
+    return -1;
+  }
+  unsigned divisor=std::abs(val);
+  int dest;
+  if(divisor==1){
+    dest=SymbolTable::getInstance()->getReg();
+    if(mod){
+      emit<<"li $"<<dest<<", 0"<<std::endl;
+    }
+    else if(val<0){
+      emit<<"subu $"<<dest<<", $zero, $"<<reg<<std::endl;
+    }
+    else{
+      emit<<"move $"<<dest<<", $"<<reg<<std::endl;
+    }
+    return dest;
+  }
+  int quot;
+  if((divisor&(divisor-1))==0){
+    int shift=0;
+    while((1u<<shift)!=divisor){
+      ++shift;
+    }
+    int bias=SymbolTable::getInstance()->getReg();
+    if(shift==1){
+      emit<<"srl $"<<bias<<", $"<<reg<<", 31"<<std::endl;
+    }
+    else{
+      emit<<"sra $"<<bias<<", $"<<reg<<", 31"<<std::endl;
+      emit<<"srl $"<<bias<<", $"<<bias<<", "<<32-shift<<std::endl;
+    }
+    int sum=SymbolTable::getInstance()->getReg();
+    emit<<"addu $"<<sum<<", $"<<reg<<", $"<<bias<<std::endl;
+    dest=SymbolTable::getInstance()->getReg();
+    if(mod){
+      if(divisor-1<=0xffff){
+        emit<<"andi $"<<sum<<", $"<<sum<<", "<<divisor-1<<std::endl;
+      }
+      else{
+        int mask=SymbolTable::getInstance()->getReg();
+        emit<<"li $"<<mask<<", "<<divisor-1<<std::endl;
+        emit<<"and $"<<sum<<", $"<<sum<<", $"<<mask<<std::endl;
+      }
+      emit<<"subu $"<<dest<<", $"<<sum<<", $"<<bias<<std::endl;
+      return dest;
+    }
+    emit<<"sra $"<<dest<<", $"<<sum<<", "<<shift<<std::endl;
+    quot=dest;
+  }
+  else{
+    const unsigned two31=0x80000000u;
+    unsigned anc=two31-1-two31%divisor;
+    unsigned q1=two31/anc, r1=two31-q1*anc, q2=two31/divisor, r2=two31-q2*divisor, delta;
+    int p=31;
+    do{
+      ++p;
+      q1*=2;
+      r1*=2;
+      if(r1>=anc){
+        ++q1;
+        r1-=anc;
+      }
+      q2*=2;
+      r2*=2;
+      if(r2>=divisor){
+        ++q2;
+        r2-=divisor;
+      }
+      delta=divisor-r2;
+    }while(q1<delta||(q1==delta&&r1==0));
+    int magic=(int)(q2+1), shift=p-32;
+    int temp=SymbolTable::getInstance()->getReg();
+    emit<<"li $"<<temp<<", "<<magic<<std::endl;
+    emit<<"mult $"<<reg<<", $"<<temp<<std::endl;
+    int high=SymbolTable::getInstance()->getReg();
+    emit<<"mfhi $"<<high<<std::endl;
+    if(magic<0){
+      emit<<"addu $"<<high<<", $"<<high<<", $"<<reg<<std::endl;
+    }
+    if(shift>0){
+      emit<<"sra $"<<high<<", $"<<high<<", "<<shift<<std::endl;
+    }
+    int sign=SymbolTable::getInstance()->getReg();
+    emit<<"srl $"<<sign<<", $"<<reg<<", 31"<<std::endl;
+    quot=SymbolTable::getInstance()->getReg();
+    emit<<"addu $"<<quot<<", $"<<high<<", $"<<sign<<std::endl;
+    if(mod){
+      int product=multConst(quot, divisor);
+      if(product<0){
+        int temp=SymbolTable::getInstance()->getReg();
+        emit<<"li $"<<temp<<", "<<divisor<<std::endl;
+        emit<<"mult $"<<quot<<", $"<<temp<<std::endl;
+        product=SymbolTable::getInstance()->getReg();
+        emit<<"mflo $"<<product<<std::endl;
+      }
+      dest=SymbolTable::getInstance()->getReg();
+      emit<<"subu $"<<dest<<", $"<<reg<<", $"<<product<<std::endl;
+      return dest;
+    }
+  }
+  if(val<0){
+    dest=SymbolTable::getInstance()->getReg();
+    emit<<"subu $"<<dest<<", $zero, $"<<quot<<std::endl;
+    return dest;
+  }
+  return quot;
 }
 
 Expression *evalUnary(Expression *expr, std::string op){
   if(expr->lit){
     return foldExprUnary(expr, op);
   }
-  int reg=((expr->type==Expression::reg)?(expr->getVal<int>()):(SymbolTable::getInstance()->getReg()));
-  int dest=SymbolTable::getInstance()->getReg();
-  if(expr->type!=Expression::reg){
-    emit<<((expr->lit)?("li $"+std::to_string(reg)+", "+std::to_string(expr->getVal<int>())):("lw $")+std::to_string(reg)+", "+std::to_string(expr->getVal<int>())+"($fp)")<<std::endl;
+  auto site=beginSite(expr, nullptr, op);
+  auto key=op+"("+valueKey(expr)+")";
+  int dest=SymbolTable::getInstance()->getValue(key);
+  if(dest>=0){
+    SymbolTable::getInstance()->release(expr, -1);
+  }
+  else{
+    int reg=loadExpr(expr);
+    SymbolTable::getInstance()->release(expr, reg);
+    dest=SymbolTable::getInstance()->getReg();
+    //Booleans are 0 or 1, so NOT of one flips the low bit rather than every bit
+    if(op=="not"&&expr->boolean){
+      emit<<"xori $"<<dest<<", $"<<reg<<", 1"<<std::endl;
+    }
+    else{
+      emit<<op<<" $"<<dest<<", $"<<reg<<std::endl;
+    }
+    SymbolTable::getInstance()->setValue(key, dest);
+  }
+  auto result=endSite(SymbolTable::getInstance()->tempExpr(dest), site);
+  result->boolean=(op=="not"&&expr->boolean);
+  return result;
+}
+
+//CHR and ORD only change how a value is read and PRED and SUCC are a single addi, so none of them are calls
+Expression *intrinsic(Expression *expr, std::string op){
+  if(expr->lit){
+    int val=expr->getInt();
+    if(op=="chr"){
+      return new Expression((char)val, Expression::charType, true);
+    }
+    if(op=="ord"){
+      return new Expression(val, Expression::intType, true);
+    }
+    val+=((op=="succ")?(1):(-1));
+    if(expr->type==Expression::boolType&&(val<0||val>1)){
+      yyerror("PRED or SUCC of a boolean out of range\n");
+    }
+    switch(expr->type){
+      case Expression::charType: return new Expression((char)val, Expression::charType, true);
+      case Expression::boolType: return new Expression((bool)val, Expression::boolType, true);
+      default: return new Expression(val, Expression::intType, true);
+    }
   }
-  emit<<op<<" $"<<dest<<", $"<<reg<<std::endl;
-  return new Expression(dest, Expression::reg);
+  if(op=="chr"||op=="ord"){
+    expr->str=(op=="chr");
+    expr->boolean=false;
+    return expr;
+  }
+  bool str=expr->str;
+  bool boolean=expr->boolean;
+  auto site=beginSite(expr, nullptr, op);
+  auto key=op+"("+valueKey(expr)+")";
+  int dest=SymbolTable::getInstance()->getValue(key);
+  if(dest<0){
+    int reg=loadExpr(expr);
+    SymbolTable::getInstance()->release(expr, reg);
+    dest=SymbolTable::getInstance()->getReg();
+    emit<<"addi $"<<dest<<", $"<<reg<<", "<<((op=="succ")?(1):(-1))<<std::endl;
+    //Only FALSE has a successor and only TRUE a predecessor, so a boolean is checked at run time
+    if(boolean){
+      auto table=SymbolTable::getInstance();
+      int label=table->rangeTraps.size();
+      table->locked.push_back(dest);
+      int test=table->getReg();
+      table->locked.pop_back();
+      emit<<"sltiu $"<<test<<", $"<<dest<<", 2"<<std::endl;
+      emit<<"beq $"<<test<<", $zero, __range"<<label<<std::endl;
+      table->freeIfDead(test);
+      table->rangeTraps[label]=std::make_pair(lineNum, dest);
+    }
+    SymbolTable::getInstance()->setValue(key, dest);
+  }
+  else{
+    SymbolTable::getInstance()->release(expr, -1);
+  }
+  auto result=endSite(SymbolTable::getInstance()->tempExpr(dest), site);
+  result->str=str;
+  result->boolean=boolean;
+  return result;
 }
 
 Expression *foldExprUnary(Expression *expr, std::string op){
@@ -619,22 +1850,59 @@ Expression *foldExpr(Expression *left, Expression *right, std::string op){
   }
 }
 
+//Moves size bytes between two frames or records. Small copies are unrolled, larger ones loop a word at a time.
+void copyWords(std::string dst, int dstOff, std::string src, int srcOff, int size){
+  if(size<=64){
+    int temp[2]={SymbolTable::getInstance()->getReg(), SymbolTable::getInstance()->getReg()};
+    for(int i=0;i<size/4;++i){
+      emit<<"lw $"<<temp[i%2]<<", "<<(srcOff+i*4)<<"($"<<src<<")"<<std::endl;
+      emit<<"sw $"<<temp[i%2]<<", "<<(dstOff+i*4)<<"($"<<dst<<")"<<std::endl;
+    }
+    return;
+  }
+  int srcReg=SymbolTable::getInstance()->getReg();
+  int dstReg=SymbolTable::getInstance()->getReg();
+  int endReg=SymbolTable::getInstance()->getReg();
+  int temp=SymbolTable::getInstance()->getReg();
+  auto label="__copy"+std::to_string(SymbolTable::getInstance()->controlLabels++);
+  emit<<"addi $"<<srcReg<<", $"<<src<<", "<<srcOff<<std::endl;
+  emit<<"addi $"<<dstReg<<", $"<<dst<<", "<<dstOff<<std::endl;
+  emit<<"addi $"<<endReg<<", $"<<srcReg<<", "<<size<<std::endl;
+  emit<<label<<": lw $"<<temp<<", 0($"<<srcReg<<")"<<std::endl;
+  emit<<"addi $"<<srcReg<<", $"<<srcReg<<", 4"<<std::endl;
+  emit<<"sw $"<<temp<<", 0($"<<dstReg<<")"<<std::endl;
+  emit<<"addi $"<<dstReg<<", $"<<dstReg<<", 4"<<std::endl;
+  emit<<"bne $"<<srcReg<<", $"<<endReg<<", "<<label<<std::endl;
+  SymbolTable::getInstance()->clearValues();
+}
+
 void assign(Expression *lval, Expression *rval){
-  int src=((rval->lit)?(SymbolTable::getInstance()->getReg()):(rval->getVal<int>()));
-  if(rval->lit){
-    emit<<"li $"<<src<<", "<<rval->getVal<int>()<<std::endl;
+  if(lval->root){
+    noteWrite(lval->root);
   }
-  if(rval->ident){
-    int reg=SymbolTable::getInstance()->getReg();
-    emit<<"lw $"<<reg<<", "<<src<<"($fp)"<<std::endl;
-    emit<<"sw $"<<reg<<", "<<lval->getVal<int>()<<"($fp)"<<std::endl;
+  //Records and arrays can only be assigned from a value of the same type, even when the sizes match
+  auto aggregate=[](Expression *expr){
+    return expr->varType&&expr->varType->typeType!=Type::type;
+  };
+  if((aggregate(lval)||aggregate(rval))&&(!lval->varType||!rval->varType||!sameType(lval->varType, rval->varType))){
+    yyerror("Incompatible types in assignment\n");
   }
-  else{
-    emit<<"sw $"<<src<<", "<<lval->getVal<int>()<<"($fp)"<<std::endl;
+  if(lval->size!=4||rval->size!=4){
+    if(rval->type==Expression::reg||rval->lit||rval->size!=lval->size){
+      yyerror("Incompatible types in assignment\n");
+    }
+    copyWords(baseReg(lval), lval->getVal<int>(), baseReg(rval), rval->getVal<int>(), lval->size);
+    SymbolTable::getInstance()->killMemory(true);
+    return;
   }
+  int src=loadExpr(rval);
+  emit<<"sw $"<<src<<", "<<address(lval)<<std::endl;
+  storeValue(lval, src);
+  SymbolTable::getInstance()->release(rval, src);
 }
 
 void write(std::vector<Expression> exprList){
+  noteIO();
   std::for_each(exprList.begin(), exprList.end(), 
     [&](Expression expr){
       if(expr.type==Expression::intType){
@@ -643,11 +1911,11 @@ void write(std::vector<Expression> exprList){
           emit<<"li $v0, 1"<<std::endl;
         }
         else if(expr.str){
-          emit<<"lw $a0, "<<expr.getVal<int>()<<"($fp)"<<std::endl;
+          emit<<"lw $a0, "<<address(&expr)<<std::endl;
           emit<<"li $v0, 11"<<std::endl;
         }
         else{
-          emit<<"lw $a0, "<<expr.getVal<int>()<<"($fp)"<<std::endl;
+          emit<<"lw $a0, "<<address(&expr)<<std::endl;
           emit<<"li $v0, 1"<<std::endl;
         }
       }
@@ -656,21 +1924,69 @@ void write(std::vector<Expression> exprList){
         emit<<"li $v0, 4"<<std::endl;
       }
       if(expr.type==Expression::charType){
-        emit<<"li $a0, "<<expr.getVal<int>()<<std::endl;
+        emit<<"li $a0, "<<expr.getInt()<<std::endl;
         emit<<"li $v0, 11"<<std::endl;
       }
+      if(expr.type==Expression::boolType){
+        emit<<"li $a0, "<<expr.getInt()<<std::endl;
+        emit<<"li $v0, 1"<<std::endl;
+      }
       if(expr.type==Expression::reg){
         emit<<"move $a0, $"<<expr.getVal<int>()<<std::endl;
-        emit<<"li $v0, 1"<<std::endl;
+        emit<<"li $v0, "<<((expr.str)?(11):(1))<<std::endl;
       }
       emit<<"syscall"<<std::endl;
     });
   // emit<<"la $a0, __newline"<<std::endl<<"li $v0, 4"<<std::endl<<"syscall"<<std::endl;
 }
 
+void SymbolTable::emitStrings(){
+  if(stringConsts.size()>0){
+    emit<<".data"<<std::endl;
+    std::for_each(stringConsts.begin(), stringConsts.end(),
+      [&](Const strConst){
+        emit<<strConst.location<<": .asciiz "<<strConst.strVal<<std::endl;
+      });
+    emit<<".text"<<std::endl;
+    stringConsts.clear();
+  }
+}
+
+//Each failed check jumps to its own stub, which passes the line and the index to a shared report. The
+//specialized copies of procedures made at call sites go after them, outside every procedure's own code.
 void SymbolTable::emitEnd(){
   emit<<"li $v0, 10"<<std::endl<<"syscall"<<std::endl;
+  //Each trap loads its line and the bad value and goes to the stub that reports them for its kind of check.
+  //The stub exits with status 1 through exit2.
+  auto stub=[&](std::string kind, std::map<int, std::pair<int, int>> &traps){
+    if(traps.empty()){
+      return;
+    }
+    std::for_each(traps.begin(), traps.end(),
+      [&](std::pair<int, std::pair<int, int>> trap){
+        emit<<"__"<<kind<<trap.first<<": li $a1, "<<trap.second.first<<std::endl;
+        emit<<"move $a2, $"<<trap.second.second<<std::endl<<"j __"<<kind<<"Error"<<std::endl;
+      });
+    emit<<"__"<<kind<<"Error: la $a0, __"<<kind<<"Value"<<std::endl<<"li $v0, 4"<<std::endl<<"syscall"<<std::endl;
+    emit<<"move $a0, $a2"<<std::endl<<"li $v0, 1"<<std::endl<<"syscall"<<std::endl;
+    emit<<"la $a0, __"<<kind<<"Line"<<std::endl<<"li $v0, 4"<<std::endl<<"syscall"<<std::endl;
+    emit<<"move $a0, $a1"<<std::endl<<"li $v0, 1"<<std::endl<<"syscall"<<std::endl;
+    emit<<"la $a0, __newline"<<std::endl<<"li $v0, 4"<<std::endl<<"syscall"<<std::endl;
+    emit<<"li $a0, 1"<<std::endl<<"li $v0, 17"<<std::endl<<"syscall"<<std::endl;
+  };
+  stub("bounds", boundsTraps);
+  stub("range", rangeTraps);
+  std::for_each(clones.begin(), clones.end(),
+    [&](std::string code){
+      emit<<code;
+    });
   emit<<".data"<<std::endl<<"__newline: .asciiz \"\\n\""<<std::endl;
+  if(!boundsTraps.empty()){
+    emit<<"__boundsValue: .asciiz \"Array index \""<<std::endl<<"__boundsLine: .asciiz \" out of bounds on line \""<<std::endl;
+  }
+  if(!rangeTraps.empty()){
+    emit<<"__rangeValue: .asciiz \"Value \""<<std::endl<<"__rangeLine: .asciiz \" out of range on line \""<<std::endl;
+  }
   if(stringConsts.size()>0){
     std::for_each(stringConsts.begin(), stringConsts.end(),
       [&](Const strConst){
@@ -680,66 +1996,153 @@ void SymbolTable::emitEnd(){
 }
 
 void read(std::vector<Expression> exprList){
+  noteIO();
   std::for_each(exprList.begin(), exprList.end(), 
     [&](Expression expr){
+      if(expr.root){
+        noteWrite(expr.root);
+      }
       if(expr.str){
-        emit<<"li $v0, 12"<<std::endl<<"syscall"<<std::endl<<"sw $v0, "<<expr.getVal<int>()<<"($fp)"<<std::endl;
+        emit<<"li $v0, 12"<<std::endl<<"syscall"<<std::endl<<"sw $v0, "<<address(&expr)<<std::endl;
       }
       else{
-        emit<<"li $v0, 5"<<std::endl<<"syscall"<<std::endl<<"sw $v0, "<<expr.getVal<int>()<<"($fp)"<<std::endl;
+        emit<<"li $v0, 5"<<std::endl<<"syscall"<<std::endl<<"sw $v0, "<<address(&expr)<<std::endl;
       }
+      storeValue(&expr, -1);
     });
 }
 
 void ifBegin(){
   SymbolTable::getInstance()->ifStack.push_back(0);
   SymbolTable::getInstance()->controlStack.push_back(SymbolTable::getInstance()->controlLabels++);
+  SymbolTable::getInstance()->switchStack.push_back(std::make_shared<SwitchSite>());
+}
+
+//Called once the left operand of AND/OR is parsed, before any code for the right one. Only boolean
+//operands short circuit; integers are combined bitwise.
+void shortCircuitLeft(Expression *left, std::string op){
+  if(left->lit||!left->isBoolean()){
+    SymbolTable::getInstance()->shortStack.push_back(nullptr);
+    return;
+  }
+  bool isAnd=op=="and";
+  auto label="__cond"+std::to_string(SymbolTable::getInstance()->condLabels++)+((isAnd)?("False"):("True"));
+  auto site=std::make_shared<JumpSite>(isAnd, label);
+  site->start=condJump(left, !isAnd, label);
+  SymbolTable::getInstance()->shortStack.push_back(site);
+}
+
+Expression *shortCircuitRight(Expression *left, Expression *right, std::string op){
+  auto site=SymbolTable::getInstance()->shortStack.back();
+  SymbolTable::getInstance()->shortStack.pop_back();
+  if(left->isBoolean()!=right->isBoolean()){
+    yyerror((std::string("Operands of ")+((op=="and")?("&"):("|"))+" must both be boolean or both be integers").data());
+  }
+  if(!site){
+    return eval(left, right, op);
+  }
+  site->right=right;
+  site->mid=emit.tellp();
+  SymbolTable::getInstance()->keepTemp(right);
+  int reg=loadExpr(right);
+  int dest=SymbolTable::getInstance()->getReg();
+  emit<<"move $"<<dest<<", $"<<reg<<std::endl;
+  emit<<"j "<<site->label<<"Done"<<std::endl;
+  emit<<site->label<<":"<<std::endl;
+  emit<<"li $"<<dest<<", "<<((site->isAnd)?(0):(1))<<std::endl;
+  emit<<site->label<<"Done:"<<std::endl;
+  SymbolTable::getInstance()->clearValues();
+  site->end=emit.tellp();
+  site->spills=SymbolTable::getInstance()->spills;
+  site->result=SymbolTable::getInstance()->tempExpr(dest);
+  site->result->boolean=true;
+  SymbolTable::getInstance()->jumpSites.push_back(site);
+  return site->result;
+}
+
+//Branches to label when cond is jumpIf and falls through otherwise. An AND/OR that was just materialized
+//is taken apart instead: its left operand's branches are pointed at label, or at the fall through when
+//they decide the opposite outcome. Returns where the branching code starts.
+std::streampos condJump(Expression *cond, bool jumpIf, std::string label){
+  auto &sites=SymbolTable::getInstance()->jumpSites;
+  auto found=std::find_if(sites.begin(), sites.end(),
+    [&](std::shared_ptr<JumpSite> site){
+      return site->result==cond&&site->end==emit.tellp()&&site->spills==SymbolTable::getInstance()->spills;
+    });
+  if(found==sites.end()){
+    auto start=emit.tellp();
+    int reg=loadExpr(cond);
+    emit<<((jumpIf)?("bne $"):("beq $"))<<reg<<", $zero, "<<label<<std::endl;
+    return start;
+  }
+  auto site=*found;
+  sites.erase(found);
+  emit.seekp(site->mid);
+  if(site->isAnd!=jumpIf){
+    condJump(site->right, jumpIf, label);
+    auto end=emit.tellp();
+    auto text=emit.str().substr(site->start, end-site->start);
+    for(auto pos=text.find(site->label);pos!=std::string::npos;pos=text.find(site->label, pos+label.size())){
+      text.replace(pos, site->label.size(), label);
+    }
+    emit.seekp(site->start);
+    emit<<text;
+  }
+  else{
+    condJump(site->right, jumpIf, label);
+    emit<<site->label<<":"<<std::endl;
+    SymbolTable::getInstance()->clearValues();
+  }
+  return site->start;
 }
 
 void controlBegin(){
   int labelCount=SymbolTable::getInstance()->controlLabels++;
+  ++SymbolTable::getInstance()->loopDepth;
   SymbolTable::getInstance()->controlStack.push_back(labelCount);
+  SymbolTable::getInstance()->clearValues();
   emit<<"__controlStmt"<<labelCount<<": ";
 }
 
 void controlCheck(Expression *cond, bool val){
   int labelCount=SymbolTable::getInstance()->controlStack.back();
-  int reg=((cond->type==Expression::reg)?(cond->getVal<int>()):(SymbolTable::getInstance()->getReg()));
-  if(cond->type!=Expression::reg){
-    emit<<((cond->lit)?("li $"+std::to_string(reg)+", "+std::to_string(cond->getVal<int>())):("lw $")+std::to_string(reg)+", "+std::to_string(cond->getVal<int>())+"($fp)")<<std::endl;
-  }
-  if(!val){
-    emit<<"bne $"<<reg<<", $zero, __controlStmtAfter"<<labelCount<<std::endl;
-  }
-  else{
-    emit<<"beq $"<<reg<<", $zero, __controlStmtAfter"<<labelCount<<std::endl;
-  }
+  condJump(cond, !val, "__controlStmtAfter"+std::to_string(labelCount));
 }
 
 void repeatCheck(Expression *cond){
   int labelCount=SymbolTable::getInstance()->controlStack.back();
-  int reg=((cond->type==Expression::reg)?(cond->getVal<int>()):(SymbolTable::getInstance()->getReg()));
-  if(cond->type!=Expression::reg){
-    emit<<((cond->lit)?("li $"+std::to_string(reg)+", "+std::to_string(cond->getVal<int>())):("lw $")+std::to_string(reg)+", "+std::to_string(cond->getVal<int>())+"($fp)")<<std::endl;
-  }
-  emit<<"beq $"<<reg<<", $zero, __controlStmt"<<labelCount<<std::endl;
+  condJump(cond, false, "__controlStmt"+std::to_string(labelCount));
   SymbolTable::getInstance()->controlStack.pop_back();
+  --SymbolTable::getInstance()->loopDepth;
 }
 
 void controlEnd(){
   emit<<"j __controlStmt"<<SymbolTable::getInstance()->controlStack.back()<<std::endl;
   emit<<"__controlStmtAfter"<<SymbolTable::getInstance()->controlStack.back()<<": "<<std::endl;
   SymbolTable::getInstance()->controlStack.pop_back();
+  --SymbolTable::getInstance()->loopDepth;
+  SymbolTable::getInstance()->clearValues();
 }
 
 void ifBranch(Expression *cond){
   int ifCount=SymbolTable::getInstance()->ifStack.back();
   int controlCount=SymbolTable::getInstance()->controlStack.back();
-  int reg=((cond->type==Expression::reg)?(cond->getVal<int>()):(SymbolTable::getInstance()->getReg()));
-  if(cond->type!=Expression::reg){
-    emit<<((cond->lit)?("li $"+std::to_string(reg)+", "+std::to_string(cond->getVal<int>())):("lw $")+std::to_string(reg)+", "+std::to_string(cond->getVal<int>())+"($fp)")<<std::endl;
+  auto condEnd=emit.tellp();
+  condJump(cond, false, "__control"+std::to_string(controlCount)+"IfStmt"+std::to_string(ifCount));
+  auto site=SymbolTable::getInstance()->switchStack.back();
+  auto compare=SymbolTable::getInstance()->lastCompare;
+  if(!site->valid||!compare||compare->result!=cond||compare->end!=condEnd
+    ||(!site->arms.empty()&&site->key!=valueKey(&compare->var))){
+    site->valid=false;
+    return;
   }
-  emit<<"beq $"<<reg<<", $zero, __control"<<controlCount<<"IfStmt"<<ifCount<<std::endl;
+  if(site->arms.empty()){
+    site->key=valueKey(&compare->var);
+    site->var=std::make_shared<Expression>(compare->var);
+  }
+  site->arms.push_back(SwitchArm(compare->val, compare->start, emit.tellp()));
+  //The test may be replaced by a dispatch at the end of the IF, so the branch can't rely on what it loaded
+  SymbolTable::getInstance()->clearValues();
 }
 
 void ifBranchEnd(){
@@ -749,21 +2152,131 @@ void ifBranchEnd(){
 void endIf(){
   int ifCount=SymbolTable::getInstance()->ifStack.back();
   int controlCount=SymbolTable::getInstance()->controlStack.back();
+  auto site=SymbolTable::getInstance()->switchStack.back();
+  SymbolTable::getInstance()->switchStack.pop_back();
+  if(site->valid&&site->arms.size()>=4){
+    emitSwitch(site, controlCount);
+  }
   emit<<"__control"<<controlCount<<"IfStmt"<<ifCount<<": "<<std::endl;
   emit<<"__controlStmtAfter"<<controlCount<<": "<<std::endl;
   SymbolTable::getInstance()->controlStack.pop_back();
   SymbolTable::getInstance()->ifStack.pop_back();
+  SymbolTable::getInstance()->clearValues();
 }
 
 void labelIfBranch(){
   int ifCount=SymbolTable::getInstance()->ifStack.back()++;
   int controlCount=SymbolTable::getInstance()->controlStack.back();
   emit<<"__control"<<controlCount<<"IfStmt"<<ifCount<<": "<<std::endl;
+  SymbolTable::getInstance()->clearValues();
+}
+
+//Replaces the chain of tests at the start of each branch with one dispatch on the variable. Dense values
+//index a jump table after a bounds check, sparse ones are found with a binary search. The default is
+//the ELSE branch, or the end of the IF when there isn't one.
+void emitSwitch(std::shared_ptr<SwitchSite> site, int controlCount){
+  auto prefix="__control"+std::to_string(controlCount);
+  auto defaultLabel=prefix+"IfStmt"+std::to_string(site->arms.size()-1);
+  std::map<int, std::string> caseMap;
+  for(int i=0;i<site->arms.size();++i){
+    caseMap.insert(std::make_pair(site->arms[i].val, prefix+"Case"+std::to_string(i)));
+  }
+  std::vector<std::pair<int, std::string>> cases(caseMap.begin(), caseMap.end());
+  long long range=(long long)cases.back().first-cases.front().first+1;
+  auto start=site->arms[0].start;
+  auto end=emit.tellp();
+  auto text=emit.str().substr(start, end-start);
+  SymbolTable::getInstance()->clearValues();
+  int reg=SymbolTable::getInstance()->getReg(), temp=SymbolTable::getInstance()->getReg();
+  std::stringstream code;
+  code<<"lw $"<<reg<<", "<<address(site->var.get())<<std::endl;
+  if(range<=2*cases.size()&&range<=1024&&cases.front().first>-32768&&cases.front().first<=32768){
+    if(cases.front().first!=0){
+      code<<"addi $"<<reg<<", $"<<reg<<", "<<-cases.front().first<<std::endl;
+    }
+    code<<"sltiu $"<<temp<<", $"<<reg<<", "<<range<<std::endl;
+    code<<"beq $"<<temp<<", $zero, "<<defaultLabel<<std::endl;
+    code<<"sll $"<<reg<<", $"<<reg<<", 2"<<std::endl;
+    code<<"la $"<<temp<<", "<<prefix<<"Table"<<std::endl;
+    code<<"add $"<<reg<<", $"<<reg<<", $"<<temp<<std::endl;
+    code<<"lw $"<<reg<<", 0($"<<reg<<")"<<std::endl;
+    code<<"jr $"<<reg<<std::endl;
+    code<<".data"<<std::endl<<prefix<<"Table: .word ";
+    for(int i=0, j=0;i<range;++i){
+      if(cases[j].first==cases.front().first+i){
+        code<<cases[j++].second;
+      }
+      else{
+        code<<defaultLabel;
+      }
+      code<<((i==range-1)?("\n"):(", "));
+    }
+    code<<".text"<<std::endl;
+  }
+  else{
+    int labels=0;
+    emitSearch(code, cases, 0, cases.size(), reg, temp, prefix, defaultLabel, labels);
+  }
+  std::streamoff cursor=0;
+  for(int i=0;i<site->arms.size();++i){
+    code<<text.substr(cursor, site->arms[i].start-start-cursor);
+    code<<prefix<<"Case"<<i<<":"<<std::endl;
+    cursor=site->arms[i].bodyStart-start;
+  }
+  code<<text.substr(cursor);
+  emit.seekp(start);
+  emit<<code.str();
+}
+
+void emitSearch(std::stringstream &code, std::vector<std::pair<int, std::string>> &cases, int lo, int hi, int reg, int temp, std::string prefix, std::string defaultLabel, int &labels){
+  if(hi-lo<=3){
+    for(int i=lo;i<hi;++i){
+      code<<"li $"<<temp<<", "<<cases[i].first<<std::endl;
+      code<<"beq $"<<reg<<", $"<<temp<<", "<<cases[i].second<<std::endl;
+    }
+    code<<"j "<<defaultLabel<<std::endl;
+    return;
+  }
+  int mid=(lo+hi)/2;
+  auto lower=prefix+"Search"+std::to_string(labels++);
+  code<<"li $"<<temp<<", "<<cases[mid].first<<std::endl;
+  code<<"beq $"<<reg<<", $"<<temp<<", "<<cases[mid].second<<std::endl;
+  code<<"slt $"<<temp<<", $"<<reg<<", $"<<temp<<std::endl;
+  code<<"bne $"<<temp<<", $zero, "<<lower<<std::endl;
+  emitSearch(code, cases, mid+1, hi, reg, temp, prefix, defaultLabel, labels);
+  code<<lower<<":"<<std::endl;
+  emitSearch(code, cases, lo, mid, reg, temp, prefix, defaultLabel, labels);
+}
+
+//The address of an argument passed by reference. Variables of the caller's own procedure are saved on the
+//stack across the call and written back afterwards, so those pass the address of the saved copy.
+int argAddress(Expression *arg, std::map<Var*, int> &backupSlots){
+  if(arg->type==Expression::reg||arg->lit||!arg->root){
+    yyerror("VAR and aggregate arguments must be variables\n");
+  }
+  noteWrite(arg->root);
+  int reg=SymbolTable::getInstance()->getReg();
+  auto slot=backupSlots.find(arg->root);
+  if(slot==backupSlots.end()||arg->root->ref){
+    emit<<"addi $"<<reg<<", $"<<baseReg(arg)<<", "<<arg->getVal<int>()<<std::endl;
+    return reg;
+  }
+  int disp=slot->second+arg->getVal<int>()-arg->root->location;
+  if(arg->addrReg<0){
+    emit<<"addi $"<<reg<<", $sp, "<<disp<<std::endl;
+    return reg;
+  }
+  emit<<"sub $"<<reg<<", $"<<arg->addrReg<<", $fp"<<std::endl;
+  emit<<"add $"<<reg<<", $"<<reg<<", $sp"<<std::endl;
+  emit<<"addi $"<<reg<<", $"<<reg<<", "<<disp<<std::endl;
+  return reg;
 }
 
 Expression *doFunc(std::string ident, std::vector<Expression> args){
   std::string label;
   std::vector<std::pair<int, int>> backupVars;
+  std::map<Var*, int> backupSlots;
+  auto start=emit.tellp();
   if(!SymbolTable::getInstance()->lookup(ident)){
     yyerror("Procedure not defined\n");
   }
@@ -774,6 +2287,81 @@ Expression *doFunc(std::string ident, std::vector<Expression> args){
   else{
     yyerror("Function cast error");
   }
+  auto current=SymbolTable::getInstance()->funcStack.back();
+  if(current&&current->name!=ident){
+    if(tempFunc->compiled){
+      current->effects.merge(tempFunc->effects);
+    }
+    else{
+      current->effects.unknownCalls=true;
+    }
+  }
+  int params=0;
+  std::for_each(tempFunc->typeList.begin(), tempFunc->typeList.end(),
+    [&](std::pair<std::vector<std::string>, std::shared_ptr<Type>> group){
+      params+=group.first.size();
+    });
+  bool literals=std::all_of(args.begin(), args.end(),
+    [](Expression &arg){
+      return arg.lit&&arg.type!=Expression::stringType;
+    });
+  //A pure function of constants is run now, and its result used in place of the call
+  if(tempFunc->pure()&&literals&&args.size()==params){
+    std::vector<std::pair<int, int>> values;
+    for(int i=0;i<args.size();++i){
+      values.push_back(std::make_pair(i*4, args[i].getInt()));
+    }
+    int result;
+    if(evaluate(tempFunc->location, tempFunc->offset, values, result)){
+      auto simple=dynamic_cast<Simple*>(tempFunc->returnType.get());
+      if(simple&&simple->simType==Simple::character){
+        return new Expression((char)result, Expression::charType, true);
+      }
+      if(simple&&simple->simType==Simple::boolean){
+        return new Expression((bool)result, Expression::boolType, true);
+      }
+      return new Expression(result, Expression::intType, true);
+    }
+  }
+  //Constants passed to parameters the callee never writes can be built into a copy of it. Copies are made
+  //for calls inside loops and for constants the callee has already been called with somewhere else.
+  std::map<int, int> fixed;
+  std::string key;
+  if(!tempFunc->code.empty()){
+    for(int i=0, k=0, offset=0;i<tempFunc->typeList.size();++i){
+      for(int j=0;j<tempFunc->typeList[i].first.size();++j, ++k){
+        if(k<args.size()&&args[k].lit&&args[k].type!=Expression::stringType&&!tempFunc->byRef(i)
+          &&tempFunc->paramSize(i)==4&&!tempFunc->paramsWritten[k]){
+          fixed[offset]=args[k].getInt();
+          key+=std::to_string(offset)+"="+std::to_string(args[k].getInt())+";";
+        }
+        offset+=tempFunc->paramSize(i);
+      }
+    }
+  }
+  if(!fixed.empty()){
+    auto clone=tempFunc->clones.find(key);
+    if(clone!=tempFunc->clones.end()){
+      label=clone->second;
+    }
+    else if((SymbolTable::getInstance()->loopDepth>0||++tempFunc->literalSites[key]>1)&&tempFunc->clones.size()<4){
+      label="_"+tempFunc->location+"_"+std::to_string(tempFunc->clones.size());
+      tempFunc->clones[key]=label;
+      SymbolTable::getInstance()->clones.push_back(specialize(tempFunc->code, tempFunc->location, label, fixed));
+    }
+    else{
+      fixed.clear();
+    }
+  }
+  //Spills have to happen before the frame is saved, or restoring it would overwrite them
+  auto &registers=SymbolTable::getInstance()->registers;
+  while(std::count(registers.begin(), registers.end(), true)<args.size()+8){
+    if(!SymbolTable::getInstance()->spill()){
+      break;
+    }
+  }
+  SymbolTable::getInstance()->noSpill=true;
+  auto wasFree=registers;
   int stackSpace=-8;
   for(int i=0;i<SymbolTable::getInstance()->registers.size();++i){
     if(!SymbolTable::getInstance()->registers[i]){
@@ -781,15 +2369,22 @@ Expression *doFunc(std::string ident, std::vector<Expression> args){
       stackSpace-=4;
     }
   }
-  std::for_each(SymbolTable::getInstance()->tables.back().begin(), SymbolTable::getInstance()->tables.back().end(),
-    [&](std::pair<std::string, std::shared_ptr<Symbol>> sym){
-      auto temp=dynamic_cast<Var*>(sym.second.get());
-      if(!temp){
-        return;
-      }
-      backupVars.push_back(std::make_pair(temp->location, -stackSpace));
-      stackSpace-=4;
-    });
+  //Procedure frames are shared with the callee, the main program's variables sit below all of them
+  if(SymbolTable::getInstance()->funcStack.back()){
+    std::for_each(SymbolTable::getInstance()->tables.back().begin(), SymbolTable::getInstance()->tables.back().end(),
+      [&](std::pair<std::string, std::shared_ptr<Symbol>> sym){
+        auto temp=dynamic_cast<Var*>(sym.second.get());
+        if(!temp){
+          return;
+        }
+        backupSlots[temp]=-stackSpace;
+        int words=((temp->ref)?(1):(std::max(1, temp->type->size/4)));
+        for(int i=0;i<words;++i){
+          backupVars.push_back(std::make_pair(temp->location+i*4, -stackSpace));
+          stackSpace-=4;
+        }
+      });
+  }
   int argMove=SymbolTable::getInstance()->getReg();
   emit<<"addi $sp, $sp, "<<stackSpace<<std::endl;
   emit<<"sw $ra, 0($sp)"<<std::endl;
@@ -798,22 +2393,58 @@ Expression *doFunc(std::string ident, std::vector<Expression> args){
     emit<<"lw $"<<argMove<<", "<<backupVars[i].first<<"($fp)"<<std::endl;
     emit<<"sw $"<<argMove<<", "<<backupVars[i].second<<"($sp)"<<std::endl;
   }
-  emit<<"move $fp, $gp"<<std::endl;
-  emit<<"addi $fp, $fp, "<<tempFunc->offset<<std::endl;
-  int stackRecover=8;
-  for(int i=0;i<args.size();++i){
-    if(args[i].type==Expression::intType){
-      if(args[i].lit){
-        emit<<"li $"<<argMove<<", "<<args[i].getVal<int>()<<std::endl;
+  //Arguments are read while $fp still points at the caller's frame. Each is a value, or an address
+  //for VAR parameters and for aggregates, which are copied into the callee's frame once it's current.
+  std::vector<int> argRegs;
+  std::vector<int> argOffsets;
+  std::vector<int> copySizes;
+  int argOffset=0;
+  for(int i=0;i<tempFunc->typeList.size();++i){
+    for(int j=0;j<tempFunc->typeList[i].first.size();++j){
+      if(argRegs.size()>=args.size()){
+        yyerror("Wrong number of arguments\n");
       }
-      else{
-        emit<<"lw $"<<argMove<<", "<<(args[i].getVal<int>()-tempFunc->offset)<<"($fp)"<<std::endl;
+      auto arg=&args[argRegs.size()];
+      int size=tempFunc->paramSize(i);
+      argOffsets.push_back(argOffset);
+      copySizes.push_back((tempFunc->byRef(i))?(0):(size));
+      argOffset+=size;
+      if(tempFunc->byRef(i)||size!=4){
+        if(!tempFunc->byRef(i)&&arg->size!=size){
+          yyerror("Argument doesn't match parameter type\n");
+        }
+        argRegs.push_back(argAddress(arg, backupSlots));
+        continue;
+      }
+      if(fixed.find(argOffsets.back())!=fixed.end()){
+        argRegs.push_back(-1);
+        continue;
       }
+      argRegs.push_back(loadExpr(arg));
     }
-    if(args[i].type==Expression::reg){
-      emit<<"move $"<<argMove<<", $"<<args[i].getVal<int>()<<std::endl;
+  }
+  if(argRegs.size()!=args.size()){
+    yyerror("Wrong number of arguments\n");
+  }
+  //Aggregates are copied through a pointer to the callee's frame, since nothing may spill once $fp has moved
+  if(std::any_of(copySizes.begin(), copySizes.end(),
+    [](int size){
+      return size>4;
+    })){
+    int frame=SymbolTable::getInstance()->getReg();
+    emit<<"addi $"<<frame<<", $gp, "<<tempFunc->offset<<std::endl;
+    for(int i=0;i<argRegs.size();++i){
+      if(copySizes[i]>4){
+        copyWords(std::to_string(frame), argOffsets[i], std::to_string(argRegs[i]), 0, copySizes[i]);
+      }
+    }
+  }
+  emit<<"move $fp, $gp"<<std::endl;
+  emit<<"addi $fp, $fp, "<<tempFunc->offset<<std::endl;
+  for(int i=0;i<argRegs.size();++i){
+    if(copySizes[i]<=4&&argRegs[i]>=0){
+      emit<<"sw $"<<argRegs[i]<<", "<<argOffsets[i]<<"($fp)"<<std::endl;
     }
-    emit<<"sw $"<<argMove<<", "<<(i*4)<<"($fp)"<<std::endl;
   }
   for(int i=0;i<SymbolTable::getInstance()->spillStack.size();++i){
     emit<<"sw $"<<SymbolTable::getInstance()->spillStack[i].first<<", "<<SymbolTable::getInstance()->spillStack[i].second<<"($sp)"<<std::endl;
@@ -831,14 +2462,65 @@ Expression *doFunc(std::string ident, std::vector<Expression> args){
     SymbolTable::getInstance()->spillStack.pop_back();
   }
   emit<<"addi $sp, $sp, "<<(-stackSpace)<<std::endl;
+  SymbolTable::getInstance()->clearValues();
+  SymbolTable::getInstance()->noSpill=false;
+  //Everything the call sequence used is dead, as are the arguments
+  for(int i=0;i<wasFree.size();++i){
+    if(wasFree[i]){
+      SymbolTable::getInstance()->freeIfDead(i+8);
+    }
+  }
+  std::for_each(args.begin(), args.end(),
+    [&](Expression &arg){
+      SymbolTable::getInstance()->unkeep(&arg);
+    });
   int reg=SymbolTable::getInstance()->getReg();
   if(tempFunc->funcType==Function::function){
     emit<<"move $"<<reg<<", $v0"<<std::endl;
   }
-  return new Expression(reg, Expression::reg);
+  auto result=SymbolTable::getInstance()->tempExpr(reg);
+  auto simple=dynamic_cast<Simple*>(tempFunc->returnType.get());
+  result->boolean=(simple&&simple->simType==Simple::boolean);
+  result->str=(simple&&simple->simType==Simple::character);
+  SymbolTable::getInstance()->lastCall=std::make_shared<CallSite>(result, ident, args, start, emit.tellp());
+  return result;
+}
+
+//A call in tail position reuses the caller's return address, so nothing is saved or restored
+//and the stack doesn't grow. Calls to the enclosing function reuse its frame and loop back to the top.
+void doTailCall(std::string ident, std::vector<Expression> args){
+  auto tempFunc=dynamic_cast<Function*>(SymbolTable::getInstance()->getSymbol(ident).get());
+  if(!tempFunc){
+    yyerror("Function cast error");
+  }
+  std::vector<int> argRegs;
+  for(int i=0;i<args.size();++i){
+    if(args[i].type==Expression::reg){
+      argRegs.push_back(args[i].getVal<int>());
+      continue;
+    }
+    argRegs.push_back(loadExpr(&args[i]));
+  }
+  auto current=SymbolTable::getInstance()->funcStack.back();
+  if(!current||current->name!=ident){
+    emit<<"move $fp, $gp"<<std::endl;
+    emit<<"addi $fp, $fp, "<<tempFunc->offset<<std::endl;
+  }
+  for(int i=0;i<argRegs.size();++i){
+    emit<<"sw $"<<argRegs[i]<<", "<<(i*4)<<"($fp)"<<std::endl;
+  }
+  emit<<"j "<<tempFunc->location<<std::endl;
 }
 
 void doReturn(Expression *retVal){
+  auto call=SymbolTable::getInstance()->lastCall;
+  auto callee=((call)?(dynamic_cast<Function*>(SymbolTable::getInstance()->getSymbol(call->ident).get())):(nullptr));
+  //Reused frames can't hold addresses into the caller's saved copy or aggregates being copied out of it
+  if(call&&call->result==retVal&&call->end==emit.tellp()&&callee&&callee->scalarParams()){
+    emit.seekp(call->start);
+    doTailCall(call->ident, call->args);
+    return;
+  }
   if(retVal->type==Expression::reg){
     emit<<"move $v0, $"<<retVal->getVal<int>()<<std::endl;
     emit<<"jr $ra"<<std::endl;
@@ -848,7 +2530,7 @@ void doReturn(Expression *retVal){
     emit<<"li $v0, "<<retVal->getVal<int>()<<std::endl;
   }
   else{
-    emit<<"lw $v0, "<<retVal->getVal<int>()<<"($fp)"<<std::endl;
+    emit<<"lw $v0, "<<address(retVal)<<std::endl;
   }
   emit<<"jr $ra"<<std::endl;
 }
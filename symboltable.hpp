@@ -5,6 +5,7 @@
 #include <memory>
 #include <vector>
 #include <iostream>
+#include <sstream>
 extern void yyerror(const char *str);
 
 #ifndef SYMBOLTABLE_H_
@@ -15,6 +16,7 @@ class Symbol{
     std::string name;
     Symbol(std::string name):name(name)
     {};
+    virtual ~Symbol(){};
     virtual void print();
     virtual bool isType();
 };
@@ -28,8 +30,10 @@ class Type:public Symbol{
     };
     TypeType typeType;
     int size;
+    int id;
     Type(std::string name, int size, TypeType typeType=type);
     virtual void print();
+    virtual std::string key();
     bool isType();
 };
 
@@ -61,10 +65,34 @@ class Var:public Symbol{
   public:
     std::shared_ptr<Type> type;
     int location;
-    Var(Type type, int location, std::string name="");
+    //A VAR parameter's slot holds the address of the caller's variable
+    bool ref;
+    bool written;
+    Var(std::shared_ptr<Type> type, int location, std::string name="", bool ref=false);
     void print();
 };
 
+//What a procedure's body does, including everything it calls. Calls to procedures that haven't been
+//compiled yet can't be known.
+class Effects{
+  public:
+    bool writesMemory;
+    bool readsGlobals;
+    bool io;
+    bool unknownCalls;
+    Effects():writesMemory(false)
+    ,readsGlobals(false)
+    ,io(false)
+    ,unknownCalls(false)
+    {};
+    void merge(Effects &other){
+      writesMemory=writesMemory||other.writesMemory;
+      readsGlobals=readsGlobals||other.readsGlobals;
+      io=io||other.io;
+      unknownCalls=unknownCalls||other.unknownCalls;
+    };
+};
+
 class Function:public Symbol{
   public:
     enum FunctionType{
@@ -76,13 +104,33 @@ class Function:public Symbol{
     int offset;
     std::shared_ptr<Type> returnType;
     std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList;
+    std::vector<bool> refs;
     bool defined;
     FunctionType funcType;
-    Function(std::string name, Type returnType, std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, bool defined=false);
+    //Filled in once the body is compiled: its effects, which parameters it writes and, for a pure function
+    //or a short procedure that can be specialized, its code, which specialized copies are made from
+    bool compiled;
+    Effects effects;
+    std::vector<bool> paramsWritten;
+    std::string code;
+    std::map<std::string, std::string> clones;
+    std::map<std::string, int> literalSites;
+    Function(std::string name, std::shared_ptr<Type> returnType, std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, bool defined=false);
     Function(std::string name, std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, bool defined=false);
+    bool byRef(int group);
+    int paramSize(int group);
+    bool scalarParams();
+    bool pure();
     void print();
 };
 
+//Formal parameter groups along with whether each was declared VAR
+class ParamList{
+  public:
+    std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList;
+    std::vector<bool> refs;
+};
+
 class Array:public Type{
   public:
     int lower;
@@ -90,6 +138,7 @@ class Array:public Type{
     std::shared_ptr<Type> type;
     Array(Type* type, Const lower, Const upper, std::string name="");
     void print();
+    std::string key();
     bool isType(){
       return true;
     };
@@ -100,6 +149,7 @@ class Record:public Type{
     std::map<std::string, std::pair<std::shared_ptr<Type>, int>> layout;
     Record(std::vector<std::pair<std::vector<std::string>, std::shared_ptr<Type>>> typeList, std::string name="");
     void print();
+    std::string key();
     bool isType(){
       return true;
     };
@@ -117,28 +167,71 @@ class Simple:public Type{
     std::shared_ptr<Type> type;
     Simple(simpleType simType, std::string name="");
     void print();
+    std::string key();
     bool isType(){
       return true;
     };
 };
 
+class Expression;
+class CallSite;
+class CompareSite;
+class JumpSite;
+class EvalSite;
+class AllocState;
+class SwitchSite;
+class LoopRange;
+
 class SymbolTable{
   public:
     std::vector<std::map<std::string, std::shared_ptr<Symbol>>> tables;
+    std::vector<std::shared_ptr<Type>> types;
+    std::map<std::string, int> typeIds;
+    std::vector<int> typeMarks;
     std::vector<int> offset;
     std::vector<bool> registers;
     std::vector<Const> stringConsts;
     std::vector<int> controlStack;
     std::vector<int> ifStack;
     std::vector<std::pair<int, int>> spillStack;
+    std::vector<std::shared_ptr<Function>> funcStack;
+    std::vector<std::shared_ptr<Function>> imported;
+    std::shared_ptr<CallSite> lastCall;
+    std::shared_ptr<CompareSite> lastCompare;
+    std::vector<std::shared_ptr<SwitchSite>> switchStack;
+    std::vector<std::shared_ptr<JumpSite>> jumpSites;
+    std::vector<std::shared_ptr<JumpSite>> shortStack;
+    std::vector<LoopRange> loopRanges;
+    std::vector<std::string> clones;
+    std::map<int, std::pair<int, int>> boundsTraps;
+    std::map<int, std::pair<int, int>> rangeTraps;
+    std::map<std::string, int> values;
+    std::vector<Expression*> temps;
+    std::vector<int> kept;
+    std::vector<int> locked;
+    std::vector<int> spillSlots;
+    int spillsUsed;
+    int spills;
+    int frameEnd;
+    bool noSpill;
+    int nextReg;
     int labels;
     int controlLabels;
     int ifLabels;
+    int condLabels;
+    int boundsChecks;
+    int boundsRemoved;
+    int keptLines;
+    int loopDepth;
     static std::shared_ptr<SymbolTable> instance;
     static std::shared_ptr<SymbolTable> getInstance();
     void pushScope(Function funcName);
     void popScope();
     void addFunction(std::string name, Function func, bool forward=false);
+    void placeImports();
+    std::shared_ptr<Type> internType(std::shared_ptr<Type> type);
+    std::shared_ptr<Type> getType(int id);
+    void addType(std::string name, Type *type);
     template <class T>
     void addSymbol(std::string name, T sym, bool init=false){
       if(tables.back().find(name)!=tables.back().end()){
@@ -155,7 +248,22 @@ class SymbolTable{
     std::shared_ptr<Symbol> getSymbol(std::string name);
     int getReg();
     void clearReg();
+    int getValue(std::string key);
+    void setValue(std::string key, int reg);
+    void killValues(std::string token);
+    void killMemory(bool all);
+    void clearValues();
+    Expression *tempExpr(int reg);
+    void keepTemp(Expression *expr);
+    void unkeep(Expression *expr);
+    void release(Expression *expr, int reg);
+    void freeIfDead(int reg);
+    int spillSlot();
+    bool spill();
+    std::shared_ptr<AllocState> saveState();
+    void restoreState(std::shared_ptr<AllocState> state);
     // void lockReg(int);
+    void emitStrings();
     void emitEnd();
   private:
     SymbolTable();
@@ -163,6 +271,9 @@ class SymbolTable{
 
 Const* negative(Const val);
 Const* notOp(Const val);
+Const* chrOp(Const val);
+Const* ordOp(Const val);
+Const* step(Const val, int delta);
 Const* mod(Const left, Const right);
 Const* div(Const left, Const right);
 Const* mult(Const left, Const right);
@@ -177,11 +288,14 @@ Const* eq(Const left, Const right);
 Const* andOp(Const left, Const right);
 Const* orOp(Const left, Const right);
 bool sameType(Const &left, Const &right);
+bool sameType(std::shared_ptr<Type> left, std::shared_ptr<Type> right);
+bool sameType(Type *left, Type *right);
+void resolveConst(Const &val);
 bool checkIdent(Const &val, Const::ConstType type);
 
 class Expression{
   public:
-    void *val;
+    std::shared_ptr<void> val;
     bool lit;
     bool str;
     bool ident;
@@ -193,33 +307,229 @@ class Expression{
       reg
     };
     Type type;
+    int addrReg;
+    //Lvalues know how many bytes they cover, which variable they're in and the type they name
+    int size;
+    Var *root;
+    ::Type *varType;
+    //Boolean valued, so AND and OR can short circuit it. Integer operands keep the bitwise and/or.
+    bool boolean;
+    std::shared_ptr<EvalSite> site;
     template<class T>
     Expression(T val, Type type, bool lit=false, bool str=false, bool ident=false):type(type)
     ,lit(lit)
     ,str(str)
-    ,ident(ident){
-      T *temp=new T(val);
-      this->val=((void*)temp);
+    ,ident(ident)
+    ,addrReg(-1)
+    ,size(4)
+    ,root(nullptr)
+    ,varType(nullptr)
+    ,boolean(false){
+      this->val=std::make_shared<T>(val);
     };
     template<class T>
     T getVal(){
-      auto temp=(T*)val;
+      auto temp=(T*)val.get();
       return *temp;
     };
+    bool isBoolean(){
+      return boolean||(lit&&type==boolType);
+    };
+    int getInt(){
+      switch(type){
+        case charType: return getVal<char>();
+        case boolType: return getVal<bool>();
+        default: return getVal<int>();
+      }
+    };
+    //Expressions allocated with new belong to the enclosing procedure and are released when its scope is popped
+    static std::vector<Expression*> pool;
+    static void *operator new(std::size_t size){
+      auto temp=::operator new(size);
+      pool.push_back((Expression*)temp);
+      return temp;
+    };
+    //An Expression deleted before its scope pops leaves the pool so it isn't freed again
+    static void operator delete(void *ptr){
+      auto slot=std::find(pool.rbegin(), pool.rend(), (Expression*)ptr);
+      if(slot!=pool.rend()){
+        *slot=nullptr;
+      }
+      ::operator delete(ptr);
+    };
+    static void releasePool(){
+      auto temp=std::move(pool);
+      pool.clear();
+      std::for_each(temp.begin(), temp.end(),
+        [&](Expression *expr){
+          delete expr;
+        });
+    };
+};
+
+class CallSite{
+  public:
+    Expression *result;
+    std::string ident;
+    std::vector<Expression> args;
+    std::streampos start;
+    std::streampos end;
+    CallSite(Expression *result, std::string ident, std::vector<Expression> args, std::streampos start, std::streampos end):result(result)
+    ,ident(ident)
+    ,args(args)
+    ,start(start)
+    ,end(end)
+    {};
+};
+
+//An equality test of a variable against a constant, as the condition of a branch in an IF chain
+class CompareSite{
+  public:
+    Expression *result;
+    Expression var;
+    int val;
+    std::streampos start;
+    std::streampos end;
+    CompareSite(Expression *result, Expression var, int val, std::streampos start, std::streampos end):result(result)
+    ,var(var)
+    ,val(val)
+    ,start(start)
+    ,end(end)
+    {};
+};
+
+//An AND/OR whose left operand branches to label when it decides the result. Its value is materialized
+//after mid, and a condition that uses it directly can drop that and branch on the right operand instead.
+class JumpSite{
+  public:
+    bool isAnd;
+    std::string label;
+    Expression *result;
+    Expression *right;
+    std::streampos start;
+    std::streampos mid;
+    std::streampos end;
+    int spills;
+    JumpSite(bool isAnd, std::string label):isAnd(isAnd)
+    ,label(label)
+    ,result(nullptr)
+    ,right(nullptr)
+    ,spills(0)
+    {};
+};
+
+//What the register allocator looked like at some point in the emitted code
+class AllocState{
+  public:
+    std::vector<bool> registers;
+    std::map<std::string, int> values;
+    std::vector<Expression*> temps;
+    int spills;
+};
+
+//The operation that computed a register and how many registers its subtree needs. A pure subtree's
+//code is exactly [start, end) and can be thrown away and regenerated from state.
+class EvalSite{
+  public:
+    std::string op;
+    Expression *left;
+    Expression *right;
+    int need;
+    bool pure;
+    std::streampos start;
+    std::streampos end;
+    std::shared_ptr<AllocState> state;
+    EvalSite(std::string op, Expression *left, Expression *right):op(op)
+    ,left(left)
+    ,right(right)
+    ,need(1)
+    ,pure(true)
+    {};
+};
+
+class SwitchArm{
+  public:
+    int val;
+    std::streampos start;
+    std::streampos bodyStart;
+    SwitchArm(int val, std::streampos start, std::streampos bodyStart):val(val)
+    ,start(start)
+    ,bodyStart(bodyStart)
+    {};
+};
+
+//An IF whose branches so far all test the same variable against constants
+class SwitchSite{
+  public:
+    bool valid;
+    std::string key;
+    std::shared_ptr<Expression> var;
+    std::vector<SwitchArm> arms;
+    SwitchSite():valid(true)
+    {};
+};
+
+//A FOR loop over constant bounds. Checks that rely on its variable staying in range are emitted, and
+//blanked when the loop ends if nothing in the body wrote the variable.
+class LoopRange{
+  public:
+    Var *var;
+    int low;
+    int high;
+    bool written;
+    bool down;
+    int trips;
+    std::streampos top;
+    std::streampos body;
+    std::vector<std::pair<std::streampos, std::string>> checks;
+    LoopRange(Var *var, int low, int high):var(var)
+    ,low(low)
+    ,high(high)
+    ,written(false)
+    ,down(false)
+    ,trips(-1)
+    {};
 };
 
 int getSize(std::string val);
 Expression *getLval(std::vector<Expression> exprList);
+bool indexRange(Expression *expr, int &low, int &high, LoopRange *&loop);
+void boundsCheckIndex(Expression *expr, Array *arr);
+void noteWrite(Var *var);
+void noteIO();
+bool isLocal(Var *var);
+void forRangeBegin(Expression *var, Expression *start);
+void forRangeLimit(Expression *limit, bool down);
+void forRangeEnd();
+void forUnroll();
 void evalBoilerPlate(int &leftReg, int &rightReg, Expression *left, Expression* right);
+std::string baseReg(Expression *expr);
+std::string address(Expression *expr);
+std::string valueKey(Expression *expr);
+int loadExpr(Expression *expr);
+void storeValue(Expression *lval, int reg);
 
+std::vector<std::pair<std::string, int>> immediateOps(std::string op, long long val, bool swapped);
 Expression *eval(Expression *left, Expression *right, std::string op);
 Expression *evalUnary(Expression *expr, std::string op);
+Expression *intrinsic(Expression *expr, std::string op);
 Expression *evalSpec(Expression *left, Expression *right, std::string op);
+int regNeed(Expression *expr);
+std::shared_ptr<EvalSite> beginSite(Expression *left, Expression *right, std::string op);
+Expression *endSite(Expression *result, std::shared_ptr<EvalSite> site);
+Expression *regen(Expression *expr);
+Expression *reorder(Expression *left, Expression *right, std::string op);
+int multConst(int reg, int val);
+int divConst(int reg, int val, bool mod);
 Expression *foldExpr(Expression *left, Expression *right, std::string op);
 Expression *foldExprUnary(Expression *expr, std::string op);
+void copyWords(std::string dst, int dstOff, std::string src, int srcOff, int size);
 void assign(Expression *lval, Expression *rval);
 void write(std::vector<Expression> exprList);
 void read(std::vector<Expression> exprList);
+void shortCircuitLeft(Expression *left, std::string op);
+Expression *shortCircuitRight(Expression *left, Expression *right, std::string op);
+std::streampos condJump(Expression *cond, bool jumpIf, std::string label);
 void controlBegin();
 void controlCheck(Expression *cond, bool val=false);
 void repeatCheck(Expression *cond);
@@ -229,7 +539,10 @@ void ifBranch(Expression *cond);
 void ifBranchEnd();
 void endIf();
 void labelIfBranch();
+void emitSwitch(std::shared_ptr<SwitchSite> site, int controlCount);
+void emitSearch(std::stringstream &code, std::vector<std::pair<int, std::string>> &cases, int lo, int hi, int reg, int temp, std::string prefix, std::string defaultLabel, int &labels);
 Expression *doFunc(std::string, std::vector<Expression>);
+void doTailCall(std::string, std::vector<Expression>);
 void doReturn(Expression *);
 
 #endif
@@ -0,0 +1,325 @@
+#include <map>
+#include "x86.hpp"
+
+//MIPS registers kept in x86 registers. The rest live in __regs, a word per register number followed by
+//HI and LO. eax, ecx and edx are scratch, and rsp is the native stack that jal and jr $ra use.
+const std::map<std::string, std::string> x86Regs={{"$fp", "ebx"}, {"$sp", "ebp"}, {"$gp", "r15d"}, {"$v0", "r14d"},
+  {"$8", "esi"}, {"$9", "edi"}, {"$10", "r8d"}, {"$11", "r9d"}, {"$12", "r10d"}, {"$13", "r11d"}, {"$14", "r12d"},
+  {"$15", "r13d"}};
+const std::map<std::string, int> mipsRegs={{"$zero", 0}, {"$at", 1}, {"$v0", 2}, {"$v1", 3}, {"$a0", 4}, {"$a1", 5},
+  {"$a2", 6}, {"$a3", 7}, {"$gp", 28}, {"$sp", 29}, {"$fp", 30}, {"$ra", 31}};
+const int hiSlot=32;
+const int loSlot=33;
+const int stackSize=1<<25;
+
+std::string regSlot(int num){
+  return "DWORD PTR __regs+"+std::to_string(num*4);
+}
+
+//Where a MIPS operand is: an x86 register, a slot in __regs, or an immediate, which $zero becomes
+std::string x86Operand(std::string arg){
+  if(arg.empty()||arg[0]!='$'){
+    return arg;
+  }
+  if(arg=="$zero"){
+    return "0";
+  }
+  auto reg=x86Regs.find(arg);
+  if(reg!=x86Regs.end()){
+    return reg->second;
+  }
+  auto name=mipsRegs.find(arg);
+  return regSlot((name!=mipsRegs.end())?(name->second):(std::stoi(arg.substr(1))));
+}
+
+bool inRegister(std::string operand){
+  return operand[0]=='e'||operand[0]=='r';
+}
+
+bool inMemory(std::string operand){
+  return operand.compare(0, 5, "DWORD")==0;
+}
+
+//The 64 bit register for addressing. Upper halves are always zero since every write is 32 bits.
+std::string wide(std::string reg){
+  return ((reg[0]=='e')?("r"+reg.substr(1)):(reg.substr(0, reg.size()-1)));
+}
+
+std::string x86Address(std::string arg, std::stringstream &code){
+  auto paren=arg.find('(');
+  int offset=std::stoi(arg.substr(0, paren));
+  auto base=x86Operand(arg.substr(paren+1, arg.find(')')-paren-1));
+  if(!inRegister(base)){
+    code<<"mov ecx, "<<base<<std::endl;
+    base="ecx";
+  }
+  return "DWORD PTR ["+wide(base)+((offset<0)?("-"):("+"))+std::to_string(std::abs(offset))+"]";
+}
+
+void x86Move(std::string dest, std::string src, std::stringstream &code){
+  if(dest==src){
+    return;
+  }
+  if(!inRegister(dest)&&inMemory(src)){
+    code<<"mov eax, "<<src<<std::endl;
+    src="eax";
+  }
+  code<<"mov "<<dest<<", "<<src<<std::endl;
+}
+
+void x86Instr(Line &line, std::stringstream &code){
+  static const std::map<std::string, std::string> arith={{"add", "add"}, {"addi", "add"}, {"addu", "add"},
+    {"addiu", "add"}, {"sub", "sub"}, {"subu", "sub"}, {"and", "and"}, {"andi", "and"}, {"or", "or"}, {"ori", "or"},
+    {"xor", "xor"}, {"xori", "xor"}, {"nor", "or"}, {"sll", "shl"}, {"srl", "shr"}, {"sra", "sar"}};
+  static const std::map<std::string, std::string> compares={{"slt", "l"}, {"slti", "l"}, {"sltu", "b"},
+    {"sltiu", "b"}, {"sgt", "g"}, {"sge", "ge"}, {"sle", "le"}, {"seq", "e"}, {"sne", "ne"}};
+  auto &op=line.op;
+  auto &args=line.args;
+  std::vector<std::string> operands;
+  std::transform(args.begin(), args.end(), std::back_inserter(operands), x86Operand);
+  //Writes to $zero are thrown away
+  bool toZero=(!args.empty()&&args[0]=="$zero"&&op!="sw"&&op!="mult"&&op!="div"&&op[0]!='b'&&op[0]!='j');
+  if(toZero){
+    return;
+  }
+  if(arith.find(op)!=arith.end()){
+    auto dest=operands[0], left=operands[1], right=operands[2];
+    auto instr=arith.at(op);
+    if(instr[0]=='s'&&instr!="sub"&&(inRegister(right)||inMemory(right))){
+      code<<"mov ecx, "<<right<<std::endl;
+      right="cl";
+    }
+    if(instr!="sub"&&instr[0]!='s'&&dest==right&&dest!=left){
+      std::swap(left, right);
+    }
+    if(inRegister(dest)&&dest!=right){
+      x86Move(dest, left, code);
+      code<<instr<<" "<<dest<<", "<<right<<std::endl;
+    }
+    else{
+      code<<"mov eax, "<<left<<std::endl;
+      code<<instr<<" eax, "<<right<<std::endl;
+      code<<"mov "<<dest<<", eax"<<std::endl;
+    }
+    if(op=="nor"){
+      code<<"not "<<dest<<std::endl;
+    }
+  }
+  else if(compares.find(op)!=compares.end()){
+    auto dest=operands[0], left=operands[1], right=operands[2];
+    if(!inRegister(left)&&(!inMemory(left)||inMemory(right))){
+      code<<"mov eax, "<<left<<std::endl;
+      left="eax";
+    }
+    code<<"cmp "<<left<<", "<<right<<std::endl;
+    code<<"set"<<compares.at(op)<<" al"<<std::endl;
+    code<<"movzx "<<((inRegister(dest))?(dest):("eax"))<<", al"<<std::endl;
+    if(!inRegister(dest)){
+      code<<"mov "<<dest<<", eax"<<std::endl;
+    }
+  }
+  else if(op=="li"||op=="move"||op=="mfhi"||op=="mflo"){
+    auto src=((op=="mfhi")?(regSlot(hiSlot)):((op=="mflo")?(regSlot(loSlot)):(operands[1])));
+    x86Move(operands[0], src, code);
+  }
+  else if(op=="la"){
+    x86Move(operands[0], "OFFSET "+args[1], code);
+  }
+  else if(op=="neg"||op=="not"){
+    x86Move(operands[0], operands[1], code);
+    code<<op<<" "<<operands[0]<<std::endl;
+  }
+  else if(op=="lw"){
+    x86Move(operands[0], x86Address(args[1], code), code);
+  }
+  else if(op=="sw"){
+    x86Move(x86Address(args[1], code), operands[0], code);
+  }
+  else if(op=="mult"||op=="div"){
+    auto right=operands[1];
+    code<<"mov eax, "<<operands[0]<<std::endl;
+    if(!inRegister(right)&&!inMemory(right)){
+      code<<"mov ecx, "<<right<<std::endl;
+      right="ecx";
+    }
+    code<<((op=="mult")?("imul "):("cdq\nidiv "))<<right<<std::endl;
+    code<<"mov "<<regSlot(loSlot)<<", eax"<<std::endl<<"mov "<<regSlot(hiSlot)<<", edx"<<std::endl;
+  }
+  else if(op=="beq"||op=="bne"){
+    auto left=operands[0], right=operands[1];
+    if(left=="0"){
+      std::swap(left, right);
+    }
+    if(left=="0"){
+      code<<((op=="beq")?("jmp "+args[2]+"\n"):(""));
+      return;
+    }
+    if(right=="0"&&inRegister(left)){
+      code<<"test "<<left<<", "<<left<<std::endl;
+    }
+    else{
+      if(!inRegister(left)&&inMemory(right)){
+        code<<"mov eax, "<<left<<std::endl;
+        left="eax";
+      }
+      code<<"cmp "<<left<<", "<<right<<std::endl;
+    }
+    code<<((op=="beq")?("je "):("jne "))<<args[2]<<std::endl;
+  }
+  else if(op=="j"){
+    code<<"jmp "<<args[0]<<std::endl;
+  }
+  else if(op=="jal"){
+    code<<"call "<<args[0]<<std::endl;
+  }
+  else if(op=="jr"&&args[0]=="$ra"){
+    code<<"ret"<<std::endl;
+  }
+  else if(op=="jr"){
+    auto target=operands[0];
+    if(!inRegister(target)){
+      code<<"mov eax, "<<target<<std::endl;
+      target="eax";
+    }
+    code<<"jmp "<<wide(target)<<std::endl;
+  }
+  else if(op=="syscall"){
+    code<<"call __syscall"<<std::endl;
+  }
+  else if(op=="nop"){
+    code<<"nop"<<std::endl;
+  }
+  else{
+    code<<".error \"No x86-64 translation for "<<op<<"\""<<std::endl;
+  }
+}
+
+std::string x86Header(){
+  return ".intel_syntax noprefix\n";
+}
+
+std::string x86Unit(CodeUnit &unit){
+  std::stringstream code;
+  std::for_each(unit.lines.begin(), unit.lines.end(),
+    [&](Line &line){
+      if(line.data&&line.op==".word"){
+        code<<".align 4"<<std::endl;
+      }
+      std::for_each(line.labels.begin(), line.labels.end(),
+        [&](std::string label){
+          code<<label<<":"<<std::endl;
+        });
+      if(line.op.empty()){
+        return;
+      }
+      if(line.op==".asciiz"){
+        code<<".asciz "<<line.args[0]<<std::endl;
+      }
+      else if(line.op==".word"){
+        code<<".long "<<line.args[0]<<std::endl;
+      }
+      else if(line.op[0]=='.'){
+        code<<line.op<<((line.args.empty())?(""):(" "+line.args[0]))<<std::endl;
+      }
+      else{
+        x86Instr(line, code);
+      }
+    });
+  return code.str();
+}
+
+//Stands in for SPIM: _start sets up the MIPS stack in the middle of its area, since globals and frames sit
+//above $sp, and __syscall does the services the compiler uses with $v0 and $a0 as under SPIM. Output is
+//buffered and flushed on exit and before reading.
+std::string x86Runtime(){
+  std::stringstream code;
+  code<<".text"<<std::endl;
+  code<<".globl _start"<<std::endl;
+  code<<"_start:"<<std::endl;
+  code<<"mov ebp, OFFSET __stack+"<<stackSize/2<<std::endl;
+  code<<"jmp __main"<<std::endl;
+  code<<"__syscall:"<<std::endl;
+  code<<"push rsi"<<std::endl<<"push rdi"<<std::endl<<"push r11"<<std::endl;
+  code<<"cmp r14d, 1"<<std::endl<<"je __rtPrintInt"<<std::endl;
+  code<<"cmp r14d, 4"<<std::endl<<"je __rtPrintString"<<std::endl;
+  code<<"cmp r14d, 11"<<std::endl<<"je __rtPrintChar"<<std::endl;
+  code<<"cmp r14d, 5"<<std::endl<<"je __rtReadInt"<<std::endl;
+  code<<"cmp r14d, 12"<<std::endl<<"je __rtReadChar"<<std::endl;
+  code<<"cmp r14d, 10"<<std::endl<<"je __rtExit"<<std::endl;
+  code<<"cmp r14d, 17"<<std::endl<<"je __rtExitCode"<<std::endl;
+  code<<"jmp __rtReturn"<<std::endl;
+  code<<"__rtPrintChar:"<<std::endl;
+  code<<"mov eax, "<<regSlot(4)<<std::endl<<"call __rtPutc"<<std::endl<<"jmp __rtReturn"<<std::endl;
+  code<<"__rtPrintString:"<<std::endl;
+  code<<"mov esi, "<<regSlot(4)<<std::endl;
+  code<<"__rtStringLoop:"<<std::endl;
+  code<<"movzx eax, BYTE PTR [rsi]"<<std::endl<<"test eax, eax"<<std::endl<<"je __rtReturn"<<std::endl;
+  code<<"call __rtPutc"<<std::endl<<"inc esi"<<std::endl<<"jmp __rtStringLoop"<<std::endl;
+  code<<"__rtPrintInt:"<<std::endl;
+  code<<"movsxd rax, "<<regSlot(4)<<std::endl<<"test rax, rax"<<std::endl<<"jns __rtDigits"<<std::endl;
+  code<<"neg rax"<<std::endl<<"mov rsi, rax"<<std::endl<<"mov eax, 45"<<std::endl<<"call __rtPutc"<<std::endl;
+  code<<"mov rax, rsi"<<std::endl;
+  code<<"__rtDigits:"<<std::endl;
+  code<<"mov esi, OFFSET __rtNumber+20"<<std::endl<<"mov ecx, 10"<<std::endl;
+  code<<"__rtDigitLoop:"<<std::endl;
+  code<<"xor edx, edx"<<std::endl<<"div rcx"<<std::endl<<"add edx, 48"<<std::endl<<"dec esi"<<std::endl;
+  code<<"mov BYTE PTR [rsi], dl"<<std::endl<<"test rax, rax"<<std::endl<<"jne __rtDigitLoop"<<std::endl;
+  code<<"__rtDigitOut:"<<std::endl;
+  code<<"movzx eax, BYTE PTR [rsi]"<<std::endl<<"call __rtPutc"<<std::endl<<"inc esi"<<std::endl;
+  code<<"cmp esi, OFFSET __rtNumber+20"<<std::endl<<"jne __rtDigitOut"<<std::endl<<"jmp __rtReturn"<<std::endl;
+  code<<"__rtReadInt:"<<std::endl;
+  code<<"call __rtGetc"<<std::endl<<"cmp eax, -1"<<std::endl<<"je __rtReadDone"<<std::endl;
+  code<<"cmp eax, 32"<<std::endl<<"jbe __rtReadInt"<<std::endl;
+  code<<"xor edi, edi"<<std::endl<<"xor esi, esi"<<std::endl;
+  code<<"cmp eax, 45"<<std::endl<<"jne __rtReadDigits"<<std::endl<<"mov esi, 1"<<std::endl<<"call __rtGetc"<<std::endl;
+  code<<"__rtReadDigits:"<<std::endl;
+  code<<"sub eax, 48"<<std::endl<<"cmp eax, 9"<<std::endl<<"ja __rtReadSign"<<std::endl;
+  code<<"imul edi, edi, 10"<<std::endl<<"add edi, eax"<<std::endl<<"call __rtGetc"<<std::endl<<"jmp __rtReadDigits"<<std::endl;
+  code<<"__rtReadSign:"<<std::endl;
+  code<<"test esi, esi"<<std::endl<<"je __rtReadDone"<<std::endl<<"neg edi"<<std::endl;
+  code<<"__rtReadDone:"<<std::endl;
+  code<<"mov r14d, edi"<<std::endl<<"jmp __rtReturn"<<std::endl;
+  code<<"__rtReadChar:"<<std::endl;
+  code<<"call __rtGetc"<<std::endl<<"mov r14d, eax"<<std::endl<<"jmp __rtReturn"<<std::endl;
+  code<<"__rtExitCode:"<<std::endl;
+  code<<"call __rtFlush"<<std::endl<<"mov edi, "<<regSlot(4)<<std::endl<<"jmp __rtQuit"<<std::endl;
+  code<<"__rtExit:"<<std::endl;
+  code<<"call __rtFlush"<<std::endl<<"xor edi, edi"<<std::endl;
+  code<<"__rtQuit:"<<std::endl;
+  code<<"mov eax, 60"<<std::endl<<"syscall"<<std::endl;
+  code<<"__rtReturn:"<<std::endl;
+  code<<"pop r11"<<std::endl<<"pop rdi"<<std::endl<<"pop rsi"<<std::endl<<"ret"<<std::endl;
+  //The character in eax goes to the output buffer. Only eax and ecx are changed.
+  code<<"__rtPutc:"<<std::endl;
+  code<<"mov ecx, DWORD PTR __rtOutLength"<<std::endl<<"mov BYTE PTR [rcx+__rtOut], al"<<std::endl;
+  code<<"inc ecx"<<std::endl<<"mov DWORD PTR __rtOutLength, ecx"<<std::endl;
+  code<<"cmp ecx, 4096"<<std::endl<<"je __rtFlush"<<std::endl<<"ret"<<std::endl;
+  code<<"__rtFlush:"<<std::endl;
+  code<<"push rdi"<<std::endl<<"push rsi"<<std::endl<<"push rdx"<<std::endl<<"push r11"<<std::endl;
+  code<<"mov eax, 1"<<std::endl<<"mov edi, 1"<<std::endl<<"mov esi, OFFSET __rtOut"<<std::endl;
+  code<<"mov edx, DWORD PTR __rtOutLength"<<std::endl<<"syscall"<<std::endl;
+  code<<"mov DWORD PTR __rtOutLength, 0"<<std::endl;
+  code<<"pop r11"<<std::endl<<"pop rdx"<<std::endl<<"pop rsi"<<std::endl<<"pop rdi"<<std::endl<<"ret"<<std::endl;
+  //The next input character in eax, or -1 at the end of the input. Only eax and ecx are changed.
+  code<<"__rtGetc:"<<std::endl;
+  code<<"mov ecx, DWORD PTR __rtInPos"<<std::endl<<"cmp ecx, DWORD PTR __rtInLength"<<std::endl<<"jl __rtGetcNext"<<std::endl;
+  code<<"call __rtFlush"<<std::endl;
+  code<<"push rdi"<<std::endl<<"push rsi"<<std::endl<<"push rdx"<<std::endl<<"push r11"<<std::endl;
+  code<<"xor eax, eax"<<std::endl<<"xor edi, edi"<<std::endl<<"mov esi, OFFSET __rtIn"<<std::endl;
+  code<<"mov edx, 4096"<<std::endl<<"syscall"<<std::endl;
+  code<<"pop r11"<<std::endl<<"pop rdx"<<std::endl<<"pop rsi"<<std::endl<<"pop rdi"<<std::endl;
+  code<<"xor ecx, ecx"<<std::endl<<"mov DWORD PTR __rtInPos, ecx"<<std::endl;
+  code<<"test eax, eax"<<std::endl<<"jg __rtGetcFill"<<std::endl;
+  code<<"mov DWORD PTR __rtInLength, ecx"<<std::endl<<"mov eax, -1"<<std::endl<<"ret"<<std::endl;
+  code<<"__rtGetcFill:"<<std::endl;
+  code<<"mov DWORD PTR __rtInLength, eax"<<std::endl;
+  code<<"__rtGetcNext:"<<std::endl;
+  code<<"movzx eax, BYTE PTR [rcx+__rtIn]"<<std::endl<<"inc ecx"<<std::endl<<"mov DWORD PTR __rtInPos, ecx"<<std::endl;
+  code<<"ret"<<std::endl;
+  code<<".bss"<<std::endl<<".align 16"<<std::endl;
+  code<<"__regs: .space "<<(loSlot+1)*4<<std::endl;
+  code<<"__rtOutLength: .space 4"<<std::endl<<"__rtInPos: .space 4"<<std::endl<<"__rtInLength: .space 4"<<std::endl;
+  code<<"__rtNumber: .space 20"<<std::endl<<"__rtOut: .space 4096"<<std::endl<<"__rtIn: .space 4096"<<std::endl;
+  code<<"__stack: .space "<<stackSize<<std::endl;
+  return code.str();
+}
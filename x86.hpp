@@ -0,0 +1,14 @@
+#include <string>
+#include "backend.hpp"
+
+#ifndef X86_H_
+#define X86_H_
+
+//The native backend translates each unit's MIPS after it has been optimized, so it makes the same
+//choices as the MIPS output. The result is GNU assembler Intel syntax for x86-64 Linux, linked without
+//libc: every address fits in 32 bits, so words and pointers are both 32 bit values.
+std::string x86Header();
+std::string x86Unit(CodeUnit &unit);
+std::string x86Runtime();
+
+#endif